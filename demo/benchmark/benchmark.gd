@@ -0,0 +1,81 @@
+extends SceneTree
+## Headless benchmark of the packet pipeline, printing one JSON object per run so results can be compared over time.
+## Usage: godot --headless --path demo -s res://benchmark/benchmark.gd -- [--quick] [--output=results.jsonl]
+##
+## Each parameter is swept on its own, starting from BASELINE, for both LaggyBenchmark.run_channels()
+## and LaggyBenchmark.run_peer(). --quick runs a tenth of the polls, for a fast smoke test.
+
+const BASELINE := {
+	"peers": 10,
+	"channels": 1,
+	"reliable": 0.0,
+	"ordered": 0.0,
+	"payload_size": 64,
+	"delay": 0.0,
+	"loss": 0.0,
+	"packets_per_poll": 100,
+	"polls": 1000,
+}
+
+const SWEEPS := {
+	"peers": [1, 10, 100, 1000],
+	"channels": [1, 4, 16],
+	"mode_mix": [
+		{ "reliable": 0.0, "ordered": 0.0 },
+		{ "reliable": 0.0, "ordered": 1.0 },
+		{ "reliable": 1.0, "ordered": 0.0 },
+		{ "reliable": 0.3, "ordered": 0.3 },
+	],
+	"payload_size": [16, 64, 1200, 8192],
+	"delay": [0.0, 0.01, 0.05],
+	"loss": [0.0, 0.05, 0.2],
+}
+
+
+func _initialize() -> void:
+	if not ClassDB.class_exists(&"LaggyBenchmark"):
+		printerr("Class 'LaggyBenchmark' is not defined, which means the GDExtension probably failed to load!")
+		quit(1)
+		return
+
+	var quick := false
+	var output: FileAccess = null
+	for argument in OS.get_cmdline_user_args():
+		if argument == "--quick":
+			quick = true
+		elif argument.begins_with("--output="):
+			output = FileAccess.open(argument.trim_prefix("--output="), FileAccess.WRITE)
+			if output == null:
+				printerr("Can't open output file: %s" % error_string(FileAccess.get_open_error()))
+				quit(1)
+				return
+
+	var version: String = Engine.get_version_info().string
+	for sweep: String in SWEEPS:
+		for value in SWEEPS[sweep]:
+			var config := BASELINE.duplicate()
+			if value is Dictionary:
+				config.merge(value, true)
+			else:
+				config[sweep] = value
+			if quick:
+				config.polls = config.polls / 10
+
+			for pipeline in ["channels", "peer"]:
+				var result: Dictionary
+				if pipeline == "channels":
+					result = LaggyBenchmark.run_channels(config)
+				else:
+					result = LaggyBenchmark.run_peer(config)
+				result.merge(config)
+				result.sweep = sweep
+				result.pipeline = pipeline
+				result.godot_version = version
+				result.timestamp = Time.get_unix_time_from_system()
+
+				var line := JSON.stringify(result, "", false)
+				print(line)
+				if output:
+					output.store_line(line)
+
+	quit()
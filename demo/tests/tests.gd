@@ -0,0 +1,218 @@
+extends SceneTree
+## Headless regression tests of the extension, printing one line per test and exiting with 1 if any failed.
+## Usage: godot --headless --path demo -s res://tests/tests.gd -- [--filter=name]
+##
+## Every method starting with "test_" is run in order. Tests use the manual clock, so they don't depend on how fast the
+## machine is, and fail through check(), which records the failure and lets the test carry on.
+
+var failures: PackedStringArray
+
+
+func _initialize() -> void:
+	if not ClassDB.class_exists(&"LaggyMultiplayerPeer"):
+		printerr("Class 'LaggyMultiplayerPeer' is not defined, which means the GDExtension probably failed to load!")
+		quit(1)
+		return
+
+	var filter := ""
+	for argument in OS.get_cmdline_user_args():
+		if argument.begins_with("--filter="):
+			filter = argument.trim_prefix("--filter=")
+
+	var failed := 0
+	for method in get_method_list():
+		var test: String = method.name
+		if not test.begins_with("test_") or not test.contains(filter):
+			continue
+		failures.clear()
+		call(test)
+		if failures.is_empty():
+			print("PASS %s" % test)
+		else:
+			failed += 1
+			print("FAIL %s" % test)
+			for failure in failures:
+				print("  %s" % failure)
+
+	quit(1 if failed > 0 else 0)
+
+
+func check(condition: bool, message: String) -> void:
+	if not condition:
+		failures.push_back(message)
+
+
+## Returns a LaggyMultiplayerPeer wrapping the server of a new hub, on the manual clock, and a client of the same hub.
+## The hub doesn't delay anything, so every delay comes from the LaggyMultiplayerPeer.
+func create_pair() -> Array:
+	var hub := LaggyNetworkHub.new()
+	hub.clock_mode = LaggyMultiplayerPeer.CLOCK_MANUAL
+	var peer := LaggyMultiplayerPeer.create(hub.create_server())
+	peer.clock_mode = LaggyMultiplayerPeer.CLOCK_MANUAL
+	peer.seed = 1
+	var client := hub.create_client()
+	peer.poll()
+	client.poll()
+	return [peer, client]
+
+
+func send(peer: MultiplayerPeer, count: int, target: int, mode: MultiplayerPeer.TransferMode, channel := 0) -> void:
+	peer.set_target_peer(target)
+	peer.transfer_mode = mode
+	peer.transfer_channel = channel
+	for i in count:
+		peer.put_packet(PackedByteArray([i % 256, i / 256, 0x5a, 0xa5, 0x0f, 0xf0, 0x33, 0xcc]))
+
+
+func drain(peer: MultiplayerPeer) -> Array[PackedByteArray]:
+	var packets: Array[PackedByteArray] = []
+	peer.poll()
+	while peer.get_available_packet_count() > 0:
+		packets.push_back(peer.get_packet())
+	return packets
+
+
+func test_pareto_jitter_is_clamped() -> void:
+	var pair := create_pair()
+	var peer: LaggyMultiplayerPeer = pair[0]
+	var client: MultiplayerPeer = pair[1]
+
+	var impairment := LaggyImpairment.new()
+	impairment.jitter = 0.05
+	impairment.jitter_maximum = 0.25
+	impairment.jitter_distribution = LaggyImpairment.JITTER_PARETO
+	impairment.pareto_shape = 0.1
+	check(impairment.pareto_shape >= 1.0, "pareto_shape went below its minimum: %f" % impairment.pareto_shape)
+	peer.impairment = impairment
+
+	const COUNT := 5000
+	send(peer, COUNT, 2, MultiplayerPeer.TRANSFER_MODE_UNRELIABLE)
+	peer.advance_time(0.25 + 0.001)
+	peer.poll()
+	var received := drain(client).size()
+	check(received == COUNT, "%d of %d packets were delivered within jitter_maximum" % [received, COUNT])
+	check(peer.get_next_delivery_time() < 0.0, "packets are still queued past jitter_maximum")
+
+
+func test_parallel_deadlines_stay_bounded() -> void:
+	var pair := create_pair()
+	var peer: LaggyMultiplayerPeer = pair[0]
+	var client: MultiplayerPeer = pair[1]
+	peer.use_worker_threads = true
+	peer.delay_minimum = 0.01
+	peer.delay_maximum = 0.05
+
+	const POLLS := 1000
+	const CHANNELS := 4
+	var received := 0
+	var most_deadlines := 0
+	for poll in POLLS:
+		for channel in CHANNELS:
+			send(peer, 1, 2, MultiplayerPeer.TRANSFER_MODE_UNRELIABLE, channel)
+		peer.advance_time(0.016)
+		peer.poll()
+		received += drain(client).size()
+		most_deadlines = maxi(most_deadlines, peer.get_memory_usage()["send_deadlines"])
+
+	# Every channel holds a few packets at most, so only a few deadlines each can be outdated at once.
+	check(most_deadlines <= CHANNELS * 8, "the deadline index grew to %d entries" % most_deadlines)
+	peer.advance_time(0.05)
+	peer.poll()
+	received += drain(client).size()
+	check(received == POLLS * CHANNELS, "%d of %d packets were delivered" % [received, POLLS * CHANNELS])
+
+
+## Sends unreliable and reliable packets for a while, and returns every packet the client received, in order.
+func run_corrupted_traffic(peer: LaggyMultiplayerPeer, client: MultiplayerPeer) -> Array[PackedByteArray]:
+	peer.packet_corruption = 0.5
+	peer.corruption_bit_rate = 0.05
+	var received: Array[PackedByteArray] = []
+	for poll in 200:
+		send(peer, 4, 2, MultiplayerPeer.TRANSFER_MODE_UNRELIABLE)
+		send(peer, 4, 2, MultiplayerPeer.TRANSFER_MODE_RELIABLE, 1)
+		peer.advance_time(0.016)
+		peer.poll()
+		received.append_array(drain(client))
+	# Reliable packets can be dropped several times in a row, so the drain is bounded rather than waiting for every one.
+	for poll in 1000:
+		if peer.get_next_delivery_time() < 0.0:
+			break
+		peer.advance_time(0.016)
+		peer.poll()
+		received.append_array(drain(client))
+	return received
+
+
+func test_replay_with_corruption_matches_recording() -> void:
+	const PATH := "user://test_replay_with_corruption.trace"
+
+	var pair := create_pair()
+	var recorded_peer: LaggyMultiplayerPeer = pair[0]
+	recorded_peer.delay_minimum = 0.01
+	recorded_peer.delay_maximum = 0.05
+	recorded_peer.packet_loss = 0.2
+	recorded_peer.start_recording(PATH)
+	var recorded := run_corrupted_traffic(recorded_peer, pair[1])
+	recorded_peer.stop_recording()
+
+	# Different conditions, which take a different amount of random numbers, while the trace decides every delay and drop.
+	pair = create_pair()
+	var replayed_peer: LaggyMultiplayerPeer = pair[0]
+	replayed_peer.delay_maximum = 0.1
+	check(replayed_peer.start_replay(PATH) == OK, "failed to open the recorded trace")
+	var replayed := run_corrupted_traffic(replayed_peer, pair[1])
+	replayed_peer.stop_replay()
+	DirAccess.remove_absolute(ProjectSettings.globalize_path(PATH))
+
+	var corrupted := 0
+	for packet in recorded:
+		if packet.slice(2) != PackedByteArray([0x5a, 0xa5, 0x0f, 0xf0, 0x33, 0xcc]):
+			corrupted += 1
+	check(corrupted > 0, "no packet was corrupted")
+	check(replayed.size() == recorded.size(), "%d packets were replayed, but %d were recorded" % [replayed.size(), recorded.size()])
+	check(replayed == recorded, "replayed packets don't match the recorded ones")
+
+
+func test_disconnect_with_pending_retries_on_delivery_thread() -> void:
+	# Real time, since the delivery thread can't run on the manual clock. Only the delivery thread uses the hub once it runs.
+	var hub := LaggyNetworkHub.new()
+	var peer := LaggyMultiplayerPeer.create(hub.create_server())
+	peer.seed = 1
+	var clients: Array[MultiplayerPeer] = [hub.create_client(), hub.create_client()]
+	peer.poll()
+	for client in clients:
+		client.poll()
+	var leaving := clients[0].get_unique_id()
+	var staying := clients[1].get_unique_id()
+	var disconnected: Array[int] = []
+	peer.peer_disconnected.connect(func(id: int) -> void: disconnected.push_back(id))
+
+	const COUNT := 128
+	peer.packet_loss = 0.9
+	peer.retry_timeout = 0.002
+	peer.max_queued_packets = COUNT * 2
+	peer.queue_overflow_policy = LaggyMultiplayerPeer.QUEUE_OVERFLOW_BACKPRESSURE
+	peer.use_delivery_thread = true
+	peer.poll()
+
+	send(peer, COUNT, leaving, MultiplayerPeer.TRANSFER_MODE_RELIABLE)
+	for poll in 20:
+		peer.poll()
+		OS.delay_msec(1)
+	# Retries keep being sent to the delivery thread until the main thread learns that the peer is gone.
+	peer.disconnect_peer(leaving)
+	for poll in 100:
+		peer.poll()
+		OS.delay_msec(1)
+
+	# Queued packets that were taken off the totals twice would wrap them around, and every send would be refused.
+	peer.packet_loss = 0.0
+	peer.set_target_peer(staying)
+	peer.transfer_mode = MultiplayerPeer.TRANSFER_MODE_RELIABLE
+	var refused := 0
+	for i in COUNT:
+		if peer.put_packet(PackedByteArray([i])) != OK:
+			refused += 1
+	check(refused == 0, "%d of %d packets were refused after the peer disconnected" % [refused, COUNT])
+	check(disconnected.size() == 1 and disconnected[0] == leaving, "peer_disconnected was emitted for %s" % [disconnected])
+	peer.close()
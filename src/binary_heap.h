@@ -0,0 +1,75 @@
+#ifndef LAGGYMULTIPLAYERPEER_BINARY_HEAP_H
+#define LAGGYMULTIPLAYERPEER_BINARY_HEAP_H
+
+#include <godot_cpp/templates/local_vector.hpp>
+
+using namespace godot;
+
+// Array-backed binary heap. Comparator(a, b) returns true when a must be popped before b.
+template <typename T, typename Comparator>
+class BinaryHeap {
+	LocalVector<T> items;
+	Comparator compare;
+
+	void sift_up(uint32_t p_index) {
+		T item = std::move(items[p_index]);
+		while (p_index > 0) {
+			uint32_t parent = (p_index - 1) / 2;
+			if (!compare(item, items[parent])) {
+				break;
+			}
+			items[p_index] = std::move(items[parent]);
+			p_index = parent;
+		}
+		items[p_index] = std::move(item);
+	}
+
+	void sift_down(uint32_t p_index) {
+		uint32_t count = items.size();
+		T item = std::move(items[p_index]);
+		while (true) {
+			uint32_t child = p_index * 2 + 1;
+			if (child >= count) {
+				break;
+			}
+			if (child + 1 < count && compare(items[child + 1], items[child])) {
+				child++;
+			}
+			if (!compare(items[child], item)) {
+				break;
+			}
+			items[p_index] = std::move(items[child]);
+			p_index = child;
+		}
+		items[p_index] = std::move(item);
+	}
+
+public:
+	_FORCE_INLINE_ uint32_t size() const { return items.size(); }
+	_FORCE_INLINE_ bool is_empty() const { return items.is_empty(); }
+	_FORCE_INLINE_ const T &top() const { return items[0]; }
+
+	void push(T &&p_item) {
+		uint32_t last = items.size();
+		items.resize(last + 1);
+		items[last] = std::move(p_item);
+		sift_up(last);
+	}
+
+	T pop() {
+		T result = std::move(items[0]);
+		uint32_t last = items.size() - 1;
+		if (last > 0) {
+			items[0] = std::move(items[last]);
+		}
+		items.resize(last);
+		if (last > 1) {
+			sift_down(0);
+		}
+		return result;
+	}
+
+	void clear() { items.clear(); }
+};
+
+#endif //LAGGYMULTIPLAYERPEER_BINARY_HEAP_H
@@ -0,0 +1,170 @@
+#include "laggy_benchmark.h"
+#include "laggy_loopback_peer.h"
+#include "laggy_multiplayer_peer.h"
+#include "laggy_packet.h"
+
+#include <godot_cpp/classes/time.hpp>
+#include <godot_cpp/core/class_db.hpp>
+
+static uint64_t get_ticks() {
+	static Time *time = Time::get_singleton();
+	return time->get_ticks_usec();
+}
+
+static PackedByteArray make_payload(int32_t p_size) {
+	PackedByteArray payload;
+	payload.resize(p_size);
+	for (int32_t i = 0; i < p_size; i++) {
+		payload.set(i, uint8_t(i));
+	}
+	return payload;
+}
+
+static Dictionary make_result(uint64_t p_sent, uint64_t p_received, uint64_t p_busy_usec, uint64_t p_total_usec, const LaggyHistogram &p_poll_times, uint64_t p_allocations) {
+	double busy_seconds = Math::max(p_busy_usec, uint64_t(1)) / 1'000'000.0;
+	Dictionary result;
+	result["packets_sent"] = p_sent;
+	result["packets_received"] = p_received;
+	result["busy_seconds"] = busy_seconds;
+	result["total_seconds"] = p_total_usec / 1'000'000.0;
+	result["packets_per_second"] = p_sent / busy_seconds;
+	result["poll_p50_usec"] = p_poll_times.get_percentile(0.5) * 1'000'000.0;
+	result["poll_p99_usec"] = p_poll_times.get_percentile(0.99) * 1'000'000.0;
+	result["allocations_per_packet"] = p_sent > 0 ? double(p_allocations) / p_sent : 0.0;
+	return result;
+}
+
+LaggyBenchmark::Config LaggyBenchmark::parse_config(const Dictionary &p_config) {
+	Config config;
+	config.peers = Math::max<int32_t>(p_config.get("peers", config.peers), 1);
+	config.channels = Math::max<int32_t>(p_config.get("channels", config.channels), 1);
+	config.reliable = Math::clamp<double>(p_config.get("reliable", config.reliable), 0.0, 1.0);
+	config.ordered = Math::clamp<double>(p_config.get("ordered", config.ordered), 0.0, 1.0 - config.reliable);
+	config.payload_size = Math::max<int32_t>(p_config.get("payload_size", config.payload_size), 0);
+	config.delay = Math::max<double>(p_config.get("delay", config.delay), 0.0);
+	config.loss = Math::clamp<double>(p_config.get("loss", config.loss), 0.0, 1.0);
+	config.packets_per_poll = Math::max<int32_t>(p_config.get("packets_per_poll", config.packets_per_poll), 0);
+	config.polls = Math::max<int32_t>(p_config.get("polls", config.polls), 1);
+	config.poll_interval = Math::max<double>(p_config.get("poll_interval", config.poll_interval), 0.0);
+	config.seed = int64_t(p_config.get("seed", int64_t(config.seed)));
+	return config;
+}
+
+MultiplayerPeer::TransferMode LaggyBenchmark::pick_mode(RandomNumberGenerator &p_rng, const Config &p_config) {
+	double roll = p_rng.randf();
+	if (roll < p_config.reliable) {
+		return MultiplayerPeer::TRANSFER_MODE_RELIABLE;
+	}
+	if (roll < p_config.reliable + p_config.ordered) {
+		return MultiplayerPeer::TRANSFER_MODE_UNRELIABLE_ORDERED;
+	}
+	return MultiplayerPeer::TRANSFER_MODE_UNRELIABLE;
+}
+
+Dictionary LaggyBenchmark::run_channels(const Dictionary &p_config) {
+	Config config = parse_config(p_config);
+	Ref<RandomNumberGenerator> rng = memnew(RandomNumberGenerator);
+	rng->set_seed(config.seed);
+
+	// The pool is declared first, so it outlives the packets still queued in the channels.
+	LaggyPacketPool pool;
+	LaggyChannelMap channels;
+	LaggyHistogram poll_times;
+	PackedByteArray payload = make_payload(config.payload_size);
+
+	uint64_t sent = 0;
+	uint64_t received = 0;
+	uint64_t busy_usec = 0;
+	uint64_t start = get_ticks();
+
+	// Time is simulated, so the delay never has to be waited for.
+	double time = 0.0;
+	for (int32_t poll = 0; poll < config.polls || channels.get_next_time() != Math_INF; poll++) {
+		uint64_t poll_start = get_ticks();
+		for (int32_t i = 0; poll < config.polls && i < config.packets_per_poll; i++) {
+			LaggyPacket packet = {
+				pool.copy(payload.ptr(), payload.size()),
+				pick_mode(*rng.ptr(), config),
+				0,
+				rng->randi_range(0, config.channels - 1),
+				LaggyLoopbackPeer::FIRST_CLIENT_ID + rng->randi_range(0, config.peers - 1),
+				time,
+				time,
+			};
+			LaggyPacketChannel &channel = channels.get_channel(packet.peer, packet.channel);
+			channel.generate_sequence(packet);
+			channel.count_queued(packet);
+			sent++;
+
+			packet.time_of_delivery += rng->randf_range(0.0, config.delay);
+			if (config.loss > 0.0 && rng->randf() < config.loss) {
+				bool retried = packet.mode == MultiplayerPeer::TRANSFER_MODE_RELIABLE;
+				channel.count_dropped(packet, retried);
+				if (!retried) {
+					continue;
+				}
+				// Stands in for the retry queue of the peer, which is benchmarked by run_peer().
+				packet.time_of_delivery += config.delay;
+			}
+			channels.push(channel, std::move(packet));
+		}
+		channels.take_due(time, [&](LaggyPacket &) {
+			received++;
+		});
+		uint64_t poll_usec = get_ticks() - poll_start;
+		busy_usec += poll_usec;
+		poll_times.record(poll_usec / 1'000'000.0);
+		time += config.poll_interval;
+	}
+
+	return make_result(sent, received, busy_usec, get_ticks() - start, poll_times, pool.get_allocation_count());
+}
+
+Dictionary LaggyBenchmark::run_peer(const Dictionary &p_config) {
+	Config config = parse_config(p_config);
+	Ref<RandomNumberGenerator> rng = memnew(RandomNumberGenerator);
+	rng->set_seed(config.seed);
+
+	Ref<LaggyLoopbackPeer> loopback = memnew(LaggyLoopbackPeer);
+	loopback->set_client_count(config.peers);
+	Ref<LaggyMultiplayerPeer> peer = LaggyMultiplayerPeer::create(loopback, 0.0, config.delay, config.loss);
+	// Like run_channels(), time is simulated, so delayed packets don't have to be waited for.
+	peer->set_clock_mode(LaggyMultiplayerPeer::CLOCK_MANUAL);
+	peer->set_seed(config.seed);
+
+	LaggyHistogram poll_times;
+	PackedByteArray payload = make_payload(config.payload_size);
+
+	uint64_t sent = 0;
+	uint64_t received = 0;
+	uint64_t busy_usec = 0;
+	uint64_t start = get_ticks();
+
+	for (int32_t poll = 0; poll < config.polls || (poll < config.polls + MAX_DRAIN_POLLS && peer->get_next_delivery_time() >= 0.0); poll++) {
+		uint64_t poll_start = get_ticks();
+		for (int32_t i = 0; poll < config.polls && i < config.packets_per_poll; i++) {
+			peer->set_target_peer(LaggyLoopbackPeer::FIRST_CLIENT_ID + rng->randi_range(0, config.peers - 1));
+			peer->set_transfer_mode(pick_mode(*rng.ptr(), config));
+			peer->set_transfer_channel(rng->randi_range(0, config.channels - 1));
+			if (peer->put_packet(payload) == OK) {
+				sent++;
+			}
+		}
+		peer->advance_time(config.poll_interval);
+		peer->poll();
+		while (peer->get_available_packet_count() > 0) {
+			peer->get_packet();
+			received++;
+		}
+		uint64_t poll_usec = get_ticks() - poll_start;
+		busy_usec += poll_usec;
+		poll_times.record(poll_usec / 1'000'000.0);
+	}
+
+	return make_result(sent, received, busy_usec, get_ticks() - start, poll_times, peer->get_packet_pool().get_allocation_count());
+}
+
+void LaggyBenchmark::_bind_methods() {
+	ClassDB::bind_static_method("LaggyBenchmark", D_METHOD("run_channels", "config"), &LaggyBenchmark::run_channels);
+	ClassDB::bind_static_method("LaggyBenchmark", D_METHOD("run_peer", "config"), &LaggyBenchmark::run_peer);
+}
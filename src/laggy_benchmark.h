@@ -0,0 +1,43 @@
+#ifndef LAGGYMULTIPLAYERPEER_BENCHMARK_H
+#define LAGGYMULTIPLAYERPEER_BENCHMARK_H
+
+#include <godot_cpp/classes/multiplayer_peer.hpp>
+#include <godot_cpp/classes/random_number_generator.hpp>
+#include <godot_cpp/classes/ref_counted.hpp>
+
+using namespace godot;
+
+// Measures the throughput and per-poll cost of the packet pipeline, without any network.
+class LaggyBenchmark : public RefCounted {
+	GDCLASS(LaggyBenchmark, RefCounted)
+
+	// Polls after the last one that sends packets, to deliver the ones still queued. Bounded, since reliable packets
+	// are never delivered when every attempt is dropped.
+	static constexpr int32_t MAX_DRAIN_POLLS = 10000;
+
+	struct Config {
+		int32_t peers = 1;
+		int32_t channels = 1;
+		double reliable = 0.0;
+		double ordered = 0.0;
+		int32_t payload_size = 64;
+		double delay = 0.0;
+		double loss = 0.0;
+		int32_t packets_per_poll = 100;
+		int32_t polls = 1000;
+		double poll_interval = 1.0 / 60.0;
+		uint64_t seed = 0;
+	};
+
+	static Config parse_config(const Dictionary &p_config);
+	static MultiplayerPeer::TransferMode pick_mode(RandomNumberGenerator &p_rng, const Config &p_config);
+
+protected:
+	static void _bind_methods();
+
+public:
+	static Dictionary run_channels(const Dictionary &p_config);
+	static Dictionary run_peer(const Dictionary &p_config);
+};
+
+#endif //LAGGYMULTIPLAYERPEER_BENCHMARK_H
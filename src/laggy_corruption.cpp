@@ -0,0 +1,83 @@
+#include "laggy_corruption.h"
+
+#include <godot_cpp/core/math.hpp>
+
+#include <cstring>
+
+static constexpr uint32_t LANE_COUNT = 4;
+
+// splitmix64, which only needs an addition and a few multiplications per word, without any branch.
+static _FORCE_INLINE_ uint64_t next_random(uint64_t &p_state) {
+	uint64_t z = (p_state += 0x9e3779b97f4a7c15);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+	return z ^ (z >> 31);
+}
+
+static _FORCE_INLINE_ uint64_t next_mask(uint64_t &p_state, uint32_t p_rate_shift) {
+	uint64_t mask = ~uint64_t(0);
+	for (uint32_t i = 0; i < p_rate_shift; i++) {
+		mask &= next_random(p_state);
+	}
+	return mask;
+}
+
+uint32_t LaggyCorruption::get_rate_shift(double p_rate) {
+	if (p_rate <= 0.0) {
+		return 0;
+	}
+	return uint32_t(Math::clamp(Math::round(-Math::log(Math::min(p_rate, 1.0)) / Math::log(2.0)), 1.0, double(MAX_RATE_SHIFT)));
+}
+
+void LaggyCorruption::flip_bits(uint8_t *p_data, int32_t p_size, uint64_t p_seed, uint32_t p_rate_shift) {
+	if (p_size <= 0) {
+		return;
+	}
+	uint64_t flipped = 0;
+
+	if (p_rate_shift > 0) {
+		uint64_t states[LANE_COUNT];
+		for (uint32_t lane = 0; lane < LANE_COUNT; lane++) {
+			states[lane] = p_seed + lane * 0xd1b54a32d192ed03;
+		}
+
+		// Words are loaded and stored with memcpy, since payloads have no particular alignment.
+		uint32_t word_count = uint32_t(p_size) / 8;
+		uint32_t word = 0;
+		for (; word + LANE_COUNT <= word_count; word += LANE_COUNT) {
+			for (uint32_t lane = 0; lane < LANE_COUNT; lane++) {
+				uint64_t mask = next_mask(states[lane], p_rate_shift);
+				uint64_t value;
+				memcpy(&value, p_data + (word + lane) * 8, 8);
+				value ^= mask;
+				memcpy(p_data + (word + lane) * 8, &value, 8);
+				flipped |= mask;
+			}
+		}
+		for (; word < word_count; word++) {
+			uint64_t mask = next_mask(states[0], p_rate_shift);
+			uint64_t value;
+			memcpy(&value, p_data + word * 8, 8);
+			value ^= mask;
+			memcpy(p_data + word * 8, &value, 8);
+			flipped |= mask;
+		}
+
+		// The last few bytes share a mask.
+		uint32_t tail = word_count * 8;
+		if (tail < uint32_t(p_size)) {
+			uint64_t mask = next_mask(states[1], p_rate_shift);
+			for (uint32_t i = tail; i < uint32_t(p_size); i++) {
+				uint8_t byte_mask = uint8_t(mask >> ((i - tail) * 8));
+				p_data[i] ^= byte_mask;
+				flipped |= byte_mask;
+			}
+		}
+	}
+
+	if (flipped == 0) {
+		// A corrupted packet always differs from the original, even when the rate is too low to flip anything.
+		uint64_t bit = next_random(p_seed) % (uint64_t(p_size) * 8);
+		p_data[bit / 8] ^= uint8_t(1 << (bit % 8));
+	}
+}
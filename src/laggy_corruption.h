@@ -0,0 +1,22 @@
+#ifndef LAGGYMULTIPLAYERPEER_CORRUPTION_H
+#define LAGGYMULTIPLAYERPEER_CORRUPTION_H
+
+#include <godot_cpp/core/defs.hpp>
+
+#include <cstdint>
+
+using namespace godot;
+
+// Flips random bits of a payload in place. Works on 64-bit words, with flip masks generated in bulk from several
+// independent random streams, so the loop has no branches that depend on the data and can be vectorized.
+struct LaggyCorruption {
+	// Bit error rates are rounded to a power of two, 2^-shift, since a mask with that rate is the AND of shift random words.
+	static constexpr uint32_t MAX_RATE_SHIFT = 24;
+
+	// Shift of the bit error rate nearest to p_rate, or 0 when only a single bit should be flipped.
+	static uint32_t get_rate_shift(double p_rate);
+	// Flips each bit with a probability of 2^-p_rate_shift, and a single random bit if that didn't flip any.
+	static void flip_bits(uint8_t *p_data, int32_t p_size, uint64_t p_seed, uint32_t p_rate_shift);
+};
+
+#endif //LAGGYMULTIPLAYERPEER_CORRUPTION_H
@@ -0,0 +1,106 @@
+#include "laggy_impairment.h"
+
+#include <godot_cpp/core/class_db.hpp>
+#include <godot_cpp/core/math.hpp>
+
+double LaggyImpairment::sample_jitter(RandomNumberGenerator &p_rng) const {
+	if (jitter <= 0.0) {
+		return 0.0;
+	}
+	switch (jitter_distribution) {
+		case JITTER_UNIFORM:
+			return p_rng.randf_range(-jitter, jitter);
+		case JITTER_NORMAL:
+			return p_rng.randfn(0.0, jitter);
+		case JITTER_PARETO: {
+			// Scaled so that the median offset is equal to the jitter.
+			double scale = jitter / Math::pow(2.0, 1.0 / pareto_shape);
+			double uniform = Math::max(1.0 - p_rng.randf(), CMP_EPSILON);
+			return scale * Math::pow(uniform, -1.0 / pareto_shape);
+		}
+		case JITTER_LOG_NORMAL:
+			return jitter * Math::exp(p_rng.randfn(0.0, log_normal_sigma));
+	}
+	return 0.0;
+}
+
+bool LaggyImpairment::sample_loss(RandomNumberGenerator &p_rng, State &p_state) const {
+	double probability = loss;
+	if (loss_model == LOSS_GILBERT_ELLIOTT) {
+		if (p_state.burst) {
+			p_state.burst = p_rng.randf() >= burst_end_probability;
+		} else {
+			p_state.burst = burst_start_probability > 0.0 && p_rng.randf() < burst_start_probability;
+		}
+		if (p_state.burst) {
+			probability = burst_loss;
+		}
+	}
+	return probability > 0.0 && p_rng.randf() < probability;
+}
+
+void LaggyImpairment::sample(RandomNumberGenerator &p_rng, State &p_state, double &out_delay, bool &out_drop_packet) const {
+	// Clamped, since a single packet delayed by the far end of a long tail would hold up its ordered or reliable channel for good.
+	double offset = Math::clamp(sample_jitter(p_rng), -jitter_maximum, jitter_maximum);
+	if (jitter_correlation > 0.0) {
+		// Blending in the previous offset keeps consecutive delays close, so jitter doesn't reorder every packet.
+		offset = jitter_correlation * p_state.last_jitter + (1.0 - jitter_correlation) * offset;
+	}
+	p_state.last_jitter = offset;
+
+	out_delay = Math::max(latency + offset, 0.0);
+	if (sample_loss(p_rng, p_state)) {
+		out_drop_packet = true;
+	}
+}
+
+void LaggyImpairment::_bind_methods() {
+	ClassDB::bind_method(D_METHOD("set_latency", "value"), &LaggyImpairment::set_latency);
+	ClassDB::bind_method(D_METHOD("get_latency"), &LaggyImpairment::get_latency);
+	ClassDB::bind_method(D_METHOD("set_jitter", "value"), &LaggyImpairment::set_jitter);
+	ClassDB::bind_method(D_METHOD("get_jitter"), &LaggyImpairment::get_jitter);
+	ClassDB::bind_method(D_METHOD("set_jitter_distribution", "distribution"), &LaggyImpairment::set_jitter_distribution);
+	ClassDB::bind_method(D_METHOD("get_jitter_distribution"), &LaggyImpairment::get_jitter_distribution);
+	ClassDB::bind_method(D_METHOD("set_jitter_correlation", "value"), &LaggyImpairment::set_jitter_correlation);
+	ClassDB::bind_method(D_METHOD("get_jitter_correlation"), &LaggyImpairment::get_jitter_correlation);
+	ClassDB::bind_method(D_METHOD("set_jitter_maximum", "value"), &LaggyImpairment::set_jitter_maximum);
+	ClassDB::bind_method(D_METHOD("get_jitter_maximum"), &LaggyImpairment::get_jitter_maximum);
+	ClassDB::bind_method(D_METHOD("set_pareto_shape", "value"), &LaggyImpairment::set_pareto_shape);
+	ClassDB::bind_method(D_METHOD("get_pareto_shape"), &LaggyImpairment::get_pareto_shape);
+	ClassDB::bind_method(D_METHOD("set_log_normal_sigma", "value"), &LaggyImpairment::set_log_normal_sigma);
+	ClassDB::bind_method(D_METHOD("get_log_normal_sigma"), &LaggyImpairment::get_log_normal_sigma);
+	ClassDB::bind_method(D_METHOD("set_loss_model", "model"), &LaggyImpairment::set_loss_model);
+	ClassDB::bind_method(D_METHOD("get_loss_model"), &LaggyImpairment::get_loss_model);
+	ClassDB::bind_method(D_METHOD("set_loss", "value"), &LaggyImpairment::set_loss);
+	ClassDB::bind_method(D_METHOD("get_loss"), &LaggyImpairment::get_loss);
+	ClassDB::bind_method(D_METHOD("set_burst_loss", "value"), &LaggyImpairment::set_burst_loss);
+	ClassDB::bind_method(D_METHOD("get_burst_loss"), &LaggyImpairment::get_burst_loss);
+	ClassDB::bind_method(D_METHOD("set_burst_start_probability", "value"), &LaggyImpairment::set_burst_start_probability);
+	ClassDB::bind_method(D_METHOD("get_burst_start_probability"), &LaggyImpairment::get_burst_start_probability);
+	ClassDB::bind_method(D_METHOD("set_burst_end_probability", "value"), &LaggyImpairment::set_burst_end_probability);
+	ClassDB::bind_method(D_METHOD("get_burst_end_probability"), &LaggyImpairment::get_burst_end_probability);
+
+	ADD_GROUP("Delay", "");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "latency", PROPERTY_HINT_RANGE, "0,5,0.001,or_greater,suffix:s"), "set_latency", "get_latency");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "jitter", PROPERTY_HINT_RANGE, "0,1,0.001,or_greater,suffix:s"), "set_jitter", "get_jitter");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "jitter_distribution", PROPERTY_HINT_ENUM, "Uniform,Normal,Pareto,Log-Normal"), "set_jitter_distribution", "get_jitter_distribution");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "jitter_correlation", PROPERTY_HINT_RANGE, "0,1,0.01"), "set_jitter_correlation", "get_jitter_correlation");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "jitter_maximum", PROPERTY_HINT_RANGE, "0,5,0.001,or_greater,suffix:s"), "set_jitter_maximum", "get_jitter_maximum");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "pareto_shape", PROPERTY_HINT_RANGE, "1,10,0.01,or_greater"), "set_pareto_shape", "get_pareto_shape");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "log_normal_sigma", PROPERTY_HINT_RANGE, "0,4,0.01,or_greater"), "set_log_normal_sigma", "get_log_normal_sigma");
+
+	ADD_GROUP("Loss", "");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "loss_model", PROPERTY_HINT_ENUM, "Independent,Gilbert-Elliott"), "set_loss_model", "get_loss_model");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "loss", PROPERTY_HINT_RANGE, "0,1,0.001"), "set_loss", "get_loss");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "burst_loss", PROPERTY_HINT_RANGE, "0,1,0.001"), "set_burst_loss", "get_burst_loss");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "burst_start_probability", PROPERTY_HINT_RANGE, "0,1,0.001"), "set_burst_start_probability", "get_burst_start_probability");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "burst_end_probability", PROPERTY_HINT_RANGE, "0,1,0.001"), "set_burst_end_probability", "get_burst_end_probability");
+
+	BIND_ENUM_CONSTANT(JITTER_UNIFORM);
+	BIND_ENUM_CONSTANT(JITTER_NORMAL);
+	BIND_ENUM_CONSTANT(JITTER_PARETO);
+	BIND_ENUM_CONSTANT(JITTER_LOG_NORMAL);
+
+	BIND_ENUM_CONSTANT(LOSS_INDEPENDENT);
+	BIND_ENUM_CONSTANT(LOSS_GILBERT_ELLIOTT);
+}
@@ -0,0 +1,98 @@
+#ifndef LAGGYMULTIPLAYERPEER_IMPAIRMENT_H
+#define LAGGYMULTIPLAYERPEER_IMPAIRMENT_H
+
+#include <godot_cpp/classes/random_number_generator.hpp>
+#include <godot_cpp/classes/resource.hpp>
+
+using namespace godot;
+
+class LaggyImpairment : public Resource {
+	GDCLASS(LaggyImpairment, Resource)
+
+public:
+	// Shapes below this have a tail so heavy that nearly all of the delay comes from a few huge samples.
+	static constexpr double MIN_PARETO_SHAPE = 1.0;
+
+	enum JitterDistribution {
+		JITTER_UNIFORM,
+		JITTER_NORMAL,
+		JITTER_PARETO,
+		JITTER_LOG_NORMAL,
+	};
+
+	enum LossModel {
+		LOSS_INDEPENDENT,
+		LOSS_GILBERT_ELLIOTT,
+	};
+
+	// Correlation and burst state of a single link direction. Owned by the peer sampling the model, not by the resource.
+	struct State {
+		double last_jitter = 0.0;
+		bool burst = false;
+	};
+
+private:
+	double latency = 0.0;
+	double jitter = 0.0;
+	JitterDistribution jitter_distribution = JITTER_UNIFORM;
+	double jitter_correlation = 0.0;
+	double jitter_maximum = 1.0;
+	double pareto_shape = 2.5;
+	double log_normal_sigma = 0.5;
+
+	LossModel loss_model = LOSS_INDEPENDENT;
+	double loss = 0.0;
+	double burst_loss = 1.0;
+	double burst_start_probability = 0.0;
+	double burst_end_probability = 1.0;
+
+	double sample_jitter(RandomNumberGenerator &p_rng) const;
+	bool sample_loss(RandomNumberGenerator &p_rng, State &p_state) const;
+
+protected:
+	static void _bind_methods();
+
+public:
+	void sample(RandomNumberGenerator &p_rng, State &p_state, double &out_delay, bool &out_drop_packet) const;
+
+	void set_latency(double p_value) { latency = Math::max(p_value, 0.0); }
+	double get_latency() const { return latency; }
+
+	void set_jitter(double p_value) { jitter = Math::max(p_value, 0.0); }
+	double get_jitter() const { return jitter; }
+
+	void set_jitter_distribution(JitterDistribution p_distribution) { jitter_distribution = p_distribution; }
+	JitterDistribution get_jitter_distribution() const { return jitter_distribution; }
+
+	void set_jitter_correlation(double p_value) { jitter_correlation = Math::clamp(p_value, 0.0, 1.0); }
+	double get_jitter_correlation() const { return jitter_correlation; }
+
+	void set_jitter_maximum(double p_value) { jitter_maximum = Math::max(p_value, 0.0); }
+	double get_jitter_maximum() const { return jitter_maximum; }
+
+	void set_pareto_shape(double p_value) { pareto_shape = Math::max(p_value, MIN_PARETO_SHAPE); }
+	double get_pareto_shape() const { return pareto_shape; }
+
+	void set_log_normal_sigma(double p_value) { log_normal_sigma = Math::max(p_value, 0.0); }
+	double get_log_normal_sigma() const { return log_normal_sigma; }
+
+	void set_loss_model(LossModel p_model) { loss_model = p_model; }
+	LossModel get_loss_model() const { return loss_model; }
+
+	void set_loss(double p_value) { loss = Math::clamp(p_value, 0.0, 1.0); }
+	double get_loss() const { return loss; }
+
+	void set_burst_loss(double p_value) { burst_loss = Math::clamp(p_value, 0.0, 1.0); }
+	double get_burst_loss() const { return burst_loss; }
+
+	void set_burst_start_probability(double p_value) { burst_start_probability = Math::clamp(p_value, 0.0, 1.0); }
+	double get_burst_start_probability() const { return burst_start_probability; }
+
+	void set_burst_end_probability(double p_value) { burst_end_probability = Math::clamp(p_value, 0.0, 1.0); }
+	double get_burst_end_probability() const { return burst_end_probability; }
+};
+
+VARIANT_ENUM_CAST(LaggyImpairment::JitterDistribution);
+VARIANT_ENUM_CAST(LaggyImpairment::LossModel);
+
+#endif //LAGGYMULTIPLAYERPEER_IMPAIRMENT_H
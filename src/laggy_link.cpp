@@ -0,0 +1,54 @@
+#include "laggy_link.h"
+
+#include <godot_cpp/core/math.hpp>
+
+int64_t LaggyLink::get_wire_size(const Settings &p_settings, int32_t p_size) const {
+	if (p_settings.overhead <= 0) {
+		return p_size;
+	}
+	int64_t fragments = p_settings.mtu > 0 ? Math::max<int64_t>(1, (p_size + p_settings.mtu - 1) / p_settings.mtu) : 1;
+	return p_size + fragments * p_settings.overhead;
+}
+
+double LaggyLink::get_backlog(const Settings &p_settings, double p_time) const {
+	if (p_settings.bandwidth <= 0.0) {
+		return 0.0;
+	}
+	return Math::max(0.0, busy_until - p_time) * p_settings.bandwidth;
+}
+
+bool LaggyLink::transmit(const Settings &p_settings, RandomNumberGenerator &p_rng, double p_time, int32_t p_size, double &r_departure) {
+	if (p_settings.bandwidth <= 0.0) {
+		r_departure = p_time;
+		return true;
+	}
+
+	int64_t wire_size = get_wire_size(p_settings, p_size);
+	double backlog = get_backlog(p_settings, p_time);
+
+	if (p_settings.queue_size > 0) {
+		if (backlog + wire_size > p_settings.queue_size) {
+			return false;
+		}
+		if (p_settings.random_early_detection) {
+			average_backlog += RED_WEIGHT * (backlog - average_backlog);
+			double minimum = RED_MINIMUM_THRESHOLD * p_settings.queue_size;
+			double maximum = RED_MAXIMUM_THRESHOLD * p_settings.queue_size;
+			if (average_backlog >= maximum) {
+				return false;
+			}
+			if (average_backlog > minimum) {
+				double probability = RED_MAXIMUM_PROBABILITY * (average_backlog - minimum) / (maximum - minimum);
+				if (p_rng.randf() < probability) {
+					return false;
+				}
+			}
+		}
+	}
+
+	// An idle link accumulates up to `burst` bytes of credit, which lets a burst through at line rate.
+	double start = Math::max(p_time - p_settings.burst / p_settings.bandwidth, busy_until);
+	busy_until = start + wire_size / p_settings.bandwidth;
+	r_departure = Math::max(p_time, busy_until);
+	return true;
+}
@@ -0,0 +1,39 @@
+#ifndef LAGGYMULTIPLAYERPEER_LINK_H
+#define LAGGYMULTIPLAYERPEER_LINK_H
+
+#include <godot_cpp/classes/random_number_generator.hpp>
+
+using namespace godot;
+
+// Bottleneck link towards a single peer: a token bucket that shapes packets to the link's bandwidth,
+// in front of a bounded queue where they wait for their turn to be serialized.
+class LaggyLink {
+	static constexpr double RED_WEIGHT = 0.002;
+	static constexpr double RED_MINIMUM_THRESHOLD = 0.25;
+	static constexpr double RED_MAXIMUM_THRESHOLD = 0.75;
+	static constexpr double RED_MAXIMUM_PROBABILITY = 0.1;
+
+public:
+	struct Settings {
+		// Bytes per second, or 0 for an unlimited link.
+		double bandwidth = 0.0;
+		int32_t burst = 0;
+		// Maximum amount of bytes waiting in the queue, or 0 for an unbounded queue.
+		int32_t queue_size = 0;
+		bool random_early_detection = false;
+		int32_t mtu = 0;
+		int32_t overhead = 0;
+	};
+
+private:
+	// Time at which every accepted byte has been serialized, minus the burst allowance still unused.
+	double busy_until = 0.0;
+	double average_backlog = 0.0;
+
+public:
+	int64_t get_wire_size(const Settings &p_settings, int32_t p_size) const;
+	double get_backlog(const Settings &p_settings, double p_time) const;
+	bool transmit(const Settings &p_settings, RandomNumberGenerator &p_rng, double p_time, int32_t p_size, double &r_departure);
+};
+
+#endif //LAGGYMULTIPLAYERPEER_LINK_H
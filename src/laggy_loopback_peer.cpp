@@ -0,0 +1,63 @@
+#include "laggy_loopback_peer.h"
+
+void LaggyLoopbackPeer::release_current_packet() {
+	if (holding_current_packet) {
+		incoming.pop_front();
+		holding_current_packet = false;
+	}
+}
+
+void LaggyLoopbackPeer::loop_back(const uint8_t *p_buffer, int32_t p_buffer_size, int32_t p_peer) {
+	Packet packet;
+	packet.data.resize(p_buffer_size);
+	memcpy(packet.data.ptrw(), p_buffer, p_buffer_size);
+	packet.mode = transfer_mode;
+	packet.channel = transfer_channel;
+	packet.peer = p_peer;
+	incoming.push_back(std::move(packet));
+}
+
+Error LaggyLoopbackPeer::_get_packet(const uint8_t **r_buffer, int32_t *r_buffer_size) {
+	release_current_packet();
+	ERR_FAIL_COND_V(incoming.is_empty(), ERR_UNAVAILABLE);
+	const Packet &packet = incoming.front();
+	*r_buffer = packet.data.ptr();
+	*r_buffer_size = packet.data.size();
+	holding_current_packet = true;
+	return OK;
+}
+
+Error LaggyLoopbackPeer::_put_packet(const uint8_t *p_buffer, int32_t p_buffer_size) {
+	int32_t last_client = FIRST_CLIENT_ID + client_count - 1;
+	if (target_peer > 0) {
+		ERR_FAIL_COND_V(target_peer < FIRST_CLIENT_ID || target_peer > last_client, ERR_INVALID_PARAMETER);
+		loop_back(p_buffer, p_buffer_size, target_peer);
+		return OK;
+	}
+	for (int32_t peer = FIRST_CLIENT_ID; peer <= last_client; peer++) {
+		if (peer != -target_peer) {
+			loop_back(p_buffer, p_buffer_size, peer);
+		}
+	}
+	return OK;
+}
+
+int32_t LaggyLoopbackPeer::_get_packet_channel() const {
+	ERR_FAIL_COND_V(_get_available_packet_count() == 0, 0);
+	return incoming[get_next_packet_index()].channel;
+}
+
+MultiplayerPeer::TransferMode LaggyLoopbackPeer::_get_packet_mode() const {
+	ERR_FAIL_COND_V(_get_available_packet_count() == 0, TRANSFER_MODE_RELIABLE);
+	return incoming[get_next_packet_index()].mode;
+}
+
+int32_t LaggyLoopbackPeer::_get_packet_peer() const {
+	ERR_FAIL_COND_V(_get_available_packet_count() == 0, 0);
+	return incoming[get_next_packet_index()].peer;
+}
+
+void LaggyLoopbackPeer::_close() {
+	incoming.clear();
+	holding_current_packet = false;
+}
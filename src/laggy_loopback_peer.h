@@ -0,0 +1,67 @@
+#ifndef LAGGYMULTIPLAYERPEER_LOOPBACK_PEER_H
+#define LAGGYMULTIPLAYERPEER_LOOPBACK_PEER_H
+
+#include "ring_queue.h"
+
+#include <godot_cpp/classes/multiplayer_peer_extension.hpp>
+
+using namespace godot;
+
+// In-process stand-in for a server connected to a number of clients, without any sockets.
+// Every packet sent to a client comes straight back, as if that client had sent it. Used to benchmark the packet pipeline.
+class LaggyLoopbackPeer : public MultiplayerPeerExtension {
+	GDCLASS(LaggyLoopbackPeer, MultiplayerPeerExtension)
+
+	struct Packet {
+		PackedByteArray data;
+		TransferMode mode = TRANSFER_MODE_RELIABLE;
+		int32_t channel = 0;
+		int32_t peer = 0;
+	};
+
+	RingQueue<Packet> incoming;
+	bool holding_current_packet = false;
+	int32_t client_count = 1;
+
+	TransferMode transfer_mode = TRANSFER_MODE_RELIABLE;
+	int32_t transfer_channel = 0;
+	int32_t target_peer = 0;
+
+	_FORCE_INLINE_ uint32_t get_next_packet_index() const { return holding_current_packet ? 1 : 0; }
+	void release_current_packet();
+	void loop_back(const uint8_t *p_buffer, int32_t p_buffer_size, int32_t p_peer);
+
+protected:
+	static void _bind_methods() {}
+
+public:
+	static constexpr int32_t FIRST_CLIENT_ID = 2;
+
+	void set_client_count(int32_t p_count) { client_count = Math::max(p_count, 1); }
+	int32_t get_client_count() const { return client_count; }
+
+	/* Virtual methods */
+	Error _get_packet(const uint8_t **r_buffer, int32_t *r_buffer_size) override;
+	Error _put_packet(const uint8_t *p_buffer, int32_t p_buffer_size) override;
+	int32_t _get_available_packet_count() const override { return incoming.size() - get_next_packet_index(); }
+	int32_t _get_max_packet_size() const override { return 0; }
+	int32_t _get_packet_channel() const override;
+	TransferMode _get_packet_mode() const override;
+	int32_t _get_packet_peer() const override;
+	void _set_transfer_channel(int32_t p_channel) override { transfer_channel = p_channel; }
+	int32_t _get_transfer_channel() const override { return transfer_channel; }
+	void _set_transfer_mode(TransferMode p_mode) override { transfer_mode = p_mode; }
+	TransferMode _get_transfer_mode() const override { return transfer_mode; }
+	void _set_target_peer(int32_t p_peer) override { target_peer = p_peer; }
+	bool _is_server() const override { return true; }
+	void _poll() override {}
+	void _close() override;
+	void _disconnect_peer(int32_t, bool) override {}
+	int32_t _get_unique_id() const override { return TARGET_PEER_SERVER; }
+	void _set_refuse_new_connections(bool) override {}
+	bool _is_refusing_new_connections() const override { return false; }
+	bool _is_server_relay_supported() const override { return false; }
+	ConnectionStatus _get_connection_status() const override { return CONNECTION_CONNECTED; }
+};
+
+#endif //LAGGYMULTIPLAYERPEER_LOOPBACK_PEER_H
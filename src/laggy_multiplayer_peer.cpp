@@ -1,41 +1,166 @@
 #include "laggy_multiplayer_peer.h"
 #include "callable_utils.h"
+#include "laggy_loopback_peer.h"
+#include "laggy_network_hub.h"
 
+#include <godot_cpp/classes/os.hpp>
+#include <godot_cpp/classes/performance.hpp>
 #include <godot_cpp/classes/time.hpp>
+#include <godot_cpp/classes/worker_thread_pool.hpp>
+#include <godot_cpp/core/mutex_lock.hpp>
 
-static double get_time() {
+static double get_real_time() {
 	static Time *time = Time::get_singleton();
 	return time->get_ticks_usec() / 1'000'000.0;
 }
 
-template <typename IterFunc>
-static void process_packets(LaggyMultiplayerPeer::PeerChannelMap &p_map, double p_time, IterFunc p_callback) {
-	for (auto &[_, channel_map] : p_map) {
-		for (auto &[_, channel] : channel_map) {
-			while (std::optional<LaggyPacket> packet = channel.take_next(p_time)) {
-				p_callback(static_cast<const LaggyPacket &>(packet.value()));
-			}
-		}
+double LaggyMultiplayerPeer::get_time() const {
+	return clock_mode == CLOCK_MANUAL ? manual_time : get_real_time();
+}
+
+LaggyMultiplayerPeer::~LaggyMultiplayerPeer() {
+	stop_delivery_thread(false);
+	update_monitors(String());
+}
+
+void LaggyMultiplayerPeer::release_current_packet() {
+	if (holding_current_packet) {
+		available_bytes -= available_packets.front().data.size();
+		available_packets.pop_front();
+		holding_current_packet = false;
 	}
 }
 
 void LaggyMultiplayerPeer::on_peer_connected(Peer p_id) {
+	send_channels.add_peer(p_id);
+	if (delivery_thread.is_valid()) {
+		// Emitted while the delivery thread polls the wrapped peer, so the signal has to be relayed on the main thread.
+		post_delivery_event({ DeliveryEvent::PEER_CONNECTED, LaggyPacket(), p_id });
+		return;
+	}
+	add_peer(p_id);
+}
+
+void LaggyMultiplayerPeer::add_peer(Peer p_id) {
+	if (!connected_peers.has(p_id)) {
+		connected_peers.push_back(p_id);
+	}
+	receive_channels.add_peer(p_id);
 	emit_signal(SNAME("peer_connected"), p_id);
 }
 
+const char *LaggyMultiplayerPeer::monitor_names[MONITOR_MAX] = {
+	"queued_packets",
+	"queued_bytes",
+	"sent_packets",
+	"received_packets",
+	"dropped_packets",
+	"retried_packets",
+	"send_delay_p99_ms",
+	"receive_delay_p99_ms",
+};
+
+const char *LaggyMultiplayerPeer::poll_phase_names[POLL_PHASE_MAX] = {
+	"total",
+	"wrapped_poll",
+	"send",
+	"receive",
+	"retry",
+	"handlers",
+	"available",
+	"put_packet",
+};
+
+static void erase_peer_packets(LocalVector<LaggyPacket> &p_packets, int32_t p_peer) {
+	uint32_t kept = 0;
+	for (uint32_t i = 0; i < p_packets.size(); i++) {
+		if (p_packets[i].peer != p_peer) {
+			p_packets[kept++] = p_packets[i];
+		}
+	}
+	p_packets.resize(kept);
+}
+
 void LaggyMultiplayerPeer::on_peer_disconnected(Peer p_id) {
-	send_channels.erase(p_id);
-	receive_channels.erase(p_id);
+	send_channels.erase_peer(p_id);
+	if (delivery_thread.is_valid()) {
+		// The delivery thread only owns the send side, the rest is removed on the main thread.
+		post_delivery_event({ DeliveryEvent::PEER_DISCONNECTED, LaggyPacket(), p_id });
+		return;
+	}
+	remove_peer(p_id);
+}
+
+void LaggyMultiplayerPeer::remove_peer(Peer p_id) {
+	connected_peers.erase(p_id);
+	// Packets waiting to be retried or batched would otherwise recreate the peer's channels.
+	retry_send_packets.erase_peer(p_id);
+	retry_receive_packets.erase_peer(p_id);
+	erase_peer_packets(batched_send_packets, p_id);
+	erase_peer_packets(batched_receive_packets, p_id);
+	receive_channels.erase_peer(p_id);
 	emit_signal(SNAME("peer_disconnected"), p_id);
 }
 
-void LaggyMultiplayerPeer::get_random_delay(double &out_delay, bool &out_drop_packet) const {
-	out_delay = rng->randf_range(delay_minimum, Math::max(delay_minimum, delay_maximum));
-	if (packet_loss > 0.0 && rng->randf() < packet_loss) {
+void LaggyMultiplayerPeer::advance_conditions(LaggyChannelMap &p_channel_map, double p_time) {
+	bool send = &p_channel_map == &send_channels;
+	LaggyProfileTrace &profile = send ? send_profile : receive_profile;
+	double bandwidth = -1.0;
+	if (profile.is_open()) {
+		profile.advance(p_time);
+		bandwidth = profile.get_sample().bandwidth;
+	} else if (has_scenario()) {
+		scenario->sample(p_time - scenario_start_time, scenario_cursor, scenario_conditions);
+		bandwidth = scenario_conditions.bandwidth;
+	}
+	apply_bandwidth(send, bandwidth);
+}
+
+void LaggyMultiplayerPeer::apply_bandwidth(bool p_send, double p_override) {
+	// The profile or scenario takes over while it sets a bandwidth, and the user's comes back once it doesn't.
+	double bandwidth = p_override >= 0.0 ? p_override : (p_send ? send_bandwidth : receive_bandwidth);
+	if (!p_send) {
+		receive_channels.link_settings.bandwidth = bandwidth;
+	} else if (bandwidth != settings.send_link.bandwidth) {
+		settings.send_link.bandwidth = bandwidth;
+		update_delivery_settings();
+	}
+}
+
+void LaggyMultiplayerPeer::sample_delay(bool p_send, RandomNumberGenerator &p_rng, LaggyImpairment::State &p_state, double &out_delay, bool &out_drop_packet) const {
+	const LaggyProfileTrace &profile = p_send ? send_profile : receive_profile;
+	if (profile.is_open()) {
+		const LaggyProfileTrace::Sample &sample = profile.get_sample();
+		out_delay = sample.delay;
+		if (sample.loss > 0.0 && p_rng.randf() < sample.loss) {
+			out_drop_packet = true;
+		}
+		return;
+	}
+	if (has_scenario()) {
+		const LaggyScenario::Keyframe &conditions = scenario_conditions;
+		out_delay = p_rng.randf_range(conditions.delay_minimum, Math::max(conditions.delay_minimum, conditions.delay_maximum));
+		if (conditions.outage || (conditions.packet_loss > 0.0 && p_rng.randf() < conditions.packet_loss)) {
+			out_drop_packet = true;
+		}
+		return;
+	}
+	if (impairment.is_valid()) {
+		impairment->sample(p_rng, p_state, out_delay, out_drop_packet);
+		return;
+	}
+	out_delay = p_rng.randf_range(delay_minimum, Math::max(delay_minimum, delay_maximum));
+	if (packet_loss > 0.0 && p_rng.randf() < packet_loss) {
 		out_drop_packet = true;
 	}
 }
 
+void LaggyMultiplayerPeer::get_random_delay(LaggyChannelMap &p_channel_map, double p_time, double &out_delay, bool &out_drop_packet) {
+	bool send = &p_channel_map == &send_channels;
+	advance_conditions(p_channel_map, p_time);
+	sample_delay(send, *rng.ptr(), send ? send_impairment_state : receive_impairment_state, out_delay, out_drop_packet);
+}
+
 void LaggyMultiplayerPeer::call_handler(const Callable &p_handler, const char *p_handler_name, int32_t p_peer, TransferMode p_mode, int32_t p_channel, int32_t p_buffer_size, double &out_delay, bool &out_drop_packet) {
 	Error err;
 	Variant result;
@@ -48,6 +173,7 @@ void LaggyMultiplayerPeer::call_handler(const Callable &p_handler, const char *p
 	drop_requested = false;
 	running_handler = true;
 
+	LaggyPollProfiler::Scope profile_scope(poll_profiler, POLL_PHASE_HANDLERS);
 	if (p_handler.get_argument_count() <= 1) {
 		result = CallableUtils::call(p_handler, err, params);
 	} else {
@@ -68,35 +194,783 @@ void LaggyMultiplayerPeer::call_handler(const Callable &p_handler, const char *p
 	out_delay = Math::max(0.0, out_delay);
 }
 
-void LaggyMultiplayerPeer::retry(Vector<LaggyPacket> &p_retry_packets, const Callable &p_custom_handler, const char *p_handler_name, double p_time, PeerChannelMap &p_channel_map) {
-	Vector<LaggyPacket> retry_again = {};
+void LaggyMultiplayerPeer::call_batch_handler(const Callable &p_handler, const char *p_handler_name, const Ref<LaggyPacketBatch> &p_batch, LocalVector<LaggyPacket> &p_packets, LaggyPacketQueue &p_retry_packets, LaggyChannelMap &p_channel_map) {
+	if (p_packets.is_empty()) {
+		return;
+	}
+	if (!p_handler.is_valid()) {
+		// The handler was removed after these packets were batched, so they go out without any delay.
+		for (LaggyPacket &packet : p_packets) {
+			dispatch(std::move(packet), 0.0, false, p_retry_packets, p_channel_map);
+		}
+		p_packets.clear();
+		return;
+	}
 
-	for (LaggyPacket &packet : p_retry_packets) {
-		ERR_CONTINUE(packet.mode != TRANSFER_MODE_RELIABLE);
+	LaggyPollProfiler::Scope profile_scope(poll_profiler, POLL_PHASE_HANDLERS);
+	p_batch->set_packets(p_packets);
 
-		if (packet.time_of_delivery > p_time) {
-			retry_again.push_back(packet);
-			continue;
+	Error err;
+	Variant result;
+	if (p_handler.get_argument_count() <= 1) {
+		result = CallableUtils::call(p_handler, err, p_batch);
+	} else {
+		result = CallableUtils::call(p_handler, err, p_batch, this);
+	}
+
+	PackedFloat64Array delays;
+	double default_delay = 0.0;
+	if (err == OK) {
+		switch (result.get_type()) {
+			case Variant::Type::PACKED_FLOAT64_ARRAY:
+				delays = result;
+				break;
+			case Variant::Type::INT:
+			case Variant::Type::FLOAT:
+				default_delay = result.operator double();
+				break;
+			case Variant::Type::NIL:
+				break;
+			default: {
+				String type = UtilityFunctions::type_string(result.get_type());
+				ERR_PRINT(vformat("%s must return a PackedFloat64Array, int, float, or null. Returned: %s.", p_handler_name, type));
+			} break;
+		}
+	}
+	if (!delays.is_empty() && delays.size() != p_packets.size()) {
+		ERR_PRINT(vformat("%s returned %d delays for %d packets.", p_handler_name, delays.size(), p_packets.size()));
+	}
+
+	const double *delays_ptr = delays.ptr();
+	uint32_t delay_count = delays.size();
+	for (uint32_t i = 0; i < p_packets.size(); i++) {
+		LaggyPacket &packet = p_packets[i];
+		double delay = Math::max(0.0, i < delay_count ? delays_ptr[i] : default_delay);
+		dispatch(std::move(packet), delay, p_batch->is_packet_dropped(i), p_retry_packets, p_channel_map);
+	}
+	p_packets.clear();
+}
+
+void LaggyMultiplayerPeer::update_delivery_settings() {
+	if (delivery_thread.is_null()) {
+		send_channels.link_settings = settings.send_link;
+		return;
+	}
+	// Picked up by the delivery thread before it processes the next requests.
+	MutexLock lock(*delivery_mutex.ptr());
+	pending_delivery_settings = settings;
+	delivery_settings_changed.store(true, std::memory_order_release);
+}
+
+double LaggyMultiplayerPeer::get_retry_wait(const PipelineSettings &p_settings, double p_delay, uint32_t p_retries) {
+	// Without a timeout, dropped packets are retried once their own delay has passed.
+	double wait = p_settings.retry_timeout > 0.0 ? p_settings.retry_timeout : p_delay;
+	if (p_settings.retry_backoff > 1.0 && p_retries > 0) {
+		wait *= Math::pow(p_settings.retry_backoff, double(p_retries));
+	}
+	if (p_settings.retry_timeout_maximum > 0.0) {
+		wait = Math::min(wait, p_settings.retry_timeout_maximum);
+	}
+	return wait;
+}
+
+void LaggyMultiplayerPeer::schedule(LaggyPacket &&p_packet, double p_delay, bool p_drop_packet, LaggyPacketQueue &p_retry_packets, LaggyChannelMap &p_channel_map, LaggyPacketChannel &p_channel, RandomNumberGenerator &p_rng) {
+	// The packet has to make it through the bottleneck queue before the rest of its delay applies.
+	double departure = p_packet.time_of_delivery;
+	if (!p_drop_packet && !p_channel_map.transmit(p_channel, p_rng, p_packet.time_of_delivery, p_packet.data.size(), departure)) {
+		p_drop_packet = true;
+	}
+
+	if (p_drop_packet) {
+		p_channel.count_dropped(p_packet, p_packet.mode == TRANSFER_MODE_RELIABLE);
+		if (p_packet.mode == TRANSFER_MODE_RELIABLE) {
+			p_packet.time_of_delivery += get_retry_wait(get_settings(p_channel_map), p_delay, p_packet.retries);
+			p_packet.retries++;
+			p_retry_packets.push(std::move(p_packet));
+		}
+		return;
+	}
+
+	p_channel_map.delay_histogram.record(departure + p_delay - p_packet.time_of_delivery);
+	p_packet.time_of_delivery = departure + p_delay;
+	p_channel_map.push(p_channel, std::move(p_packet));
+}
+
+void LaggyMultiplayerPeer::corrupt(LaggyPacket &p_packet) {
+	if (p_packet.data.size() == 0) {
+		return;
+	}
+	if (p_packet.data.is_shared()) {
+		// Copied on write, so duplicates and the other packets of a broadcast keep the original payload.
+		LaggyPacketData data = packet_pool.copy(p_packet.data.ptr(), p_packet.data.size());
+		ERR_FAIL_COND(data.is_null());
+		p_packet.data = std::move(data);
+	}
+	uint64_t seed = (uint64_t(mutation_rng->randi()) << 32) | uint64_t(mutation_rng->randi());
+	LaggyCorruption::flip_bits(p_packet.data.ptrw(), p_packet.data.size(), seed, corruption_rate_shift);
+}
+
+bool LaggyMultiplayerPeer::mutate(LaggyPacket &p_packet, double &r_delay, bool p_drop_packet, LaggyPacket &r_duplicate) {
+	// Only the attempt that gets through is impaired, so reliable packets that were retried are as likely to be as the others.
+	if (p_drop_packet || p_packet.mutated) {
+		return false;
+	}
+	// Marked even when nothing happens, so a packet that is dropped by the link after this isn't given a second chance.
+	p_packet.mutated = true;
+	if (packet_reordering > 0.0 && mutation_rng->randf() < packet_reordering) {
+		// Skips its delay, so it overtakes the packets sent before it.
+		r_delay = 0.0;
+	}
+	// Ordered and reliable modes never deliver the same packet twice, so only unreliable packets are duplicated.
+	bool duplicated = p_packet.mode == TRANSFER_MODE_UNRELIABLE && packet_duplication > 0.0 && mutation_rng->randf() < packet_duplication;
+	if (duplicated) {
+		r_duplicate = p_packet;
+	}
+	if (packet_corruption > 0.0) {
+		if (mutation_rng->randf() < packet_corruption) {
+			corrupt(p_packet);
+		}
+		if (duplicated && mutation_rng->randf() < packet_corruption) {
+			corrupt(r_duplicate);
+		}
+	}
+	return duplicated;
+}
+
+void LaggyMultiplayerPeer::schedule_duplicate(LaggyPacket &&p_packet, double p_delay, LaggyPacketQueue &p_retry_packets, LaggyChannelMap &p_channel_map, LaggyPacketChannel &p_channel) {
+	if (!admit(p_channel_map, p_channel, p_packet)) {
+		return;
+	}
+	p_channel.count_queued(p_packet);
+	schedule(std::move(p_packet), p_delay, false, p_retry_packets, p_channel_map, p_channel, *rng.ptr());
+}
+
+void LaggyMultiplayerPeer::trace(const LaggyPacket &p_packet, LaggyTraceRecord::Direction p_direction, double &r_delay, bool &r_drop_packet) {
+	LaggyTraceReader &replay_reader = replay_readers[p_direction];
+	LaggyTraceRecord record;
+	if (replay_reader.is_open() && replay_reader.next(record)) {
+		// Decisions are matched to packets by order, which only holds while the traffic is the same as when recording.
+		if (!replay_diverged && (record.peer != p_packet.peer || record.channel != p_packet.channel || record.mode != p_packet.mode || record.size != p_packet.data.size())) {
+			replay_diverged = true;
+			WARN_PRINT(vformat("Replayed traffic diverged from the trace at %.3f seconds, delays may no longer match.", record.time));
 		}
+		r_delay = record.delay;
+		r_drop_packet = record.is_dropped();
+	}
+
+	if (trace_writer.is_open()) {
+		record.time = p_packet.time_of_delivery;
+		record.delay = r_delay;
+		record.peer = p_packet.peer;
+		record.channel = p_packet.channel;
+		record.size = p_packet.data.size();
+		record.retries = p_packet.retries;
+		record.direction = p_direction;
+		record.mode = p_packet.mode;
+		record.flags = r_drop_packet ? LaggyTraceRecord::FLAG_DROPPED : 0;
+		trace_writer.write(record, p_packet.data.ptr());
+	}
+}
+
+void LaggyMultiplayerPeer::dispatch(LaggyPacket &&p_packet, double p_delay, bool p_drop_packet, LaggyPacketQueue &p_retry_packets, LaggyChannelMap &p_channel_map) {
+	// Traced first, so the packet is impaired according to the drop decision that was replayed.
+	if (trace_writer.is_open() || is_replaying()) {
+		trace(p_packet, &p_channel_map == &send_channels ? LaggyTraceRecord::DIRECTION_SEND : LaggyTraceRecord::DIRECTION_RECEIVE, p_delay, p_drop_packet);
+	}
+	LaggyPacket duplicate;
+	bool duplicated = has_mutations() && mutate(p_packet, p_delay, p_drop_packet, duplicate);
+	if (&p_channel_map == &send_channels && delivery_thread.is_valid()) {
+		submit_delivery_request({ DeliveryRequest::SEND_PACKET, std::move(p_packet), p_delay, p_drop_packet });
+		if (duplicated) {
+			// Queued by the delivery thread like any other new packet.
+			submit_delivery_request({ DeliveryRequest::SEND_PACKET, std::move(duplicate), p_delay, false });
+		}
+		return;
+	}
+	LaggyPacketChannel &channel = p_channel_map.get_channel(p_packet.peer, p_packet.channel);
+	schedule(std::move(p_packet), p_delay, p_drop_packet, p_retry_packets, p_channel_map, channel, *rng.ptr());
+	if (duplicated) {
+		schedule_duplicate(std::move(duplicate), p_delay, p_retry_packets, p_channel_map, channel);
+	}
+}
+
+void LaggyMultiplayerPeer::put_wrapped_packet(const LaggyPacket &p_packet) {
+	if (native_wrapped_peer) {
+		// Direct calls, which only store the target, and take the payload without copying it into an array first.
+		native_wrapped_peer->_set_target_peer(p_packet.peer);
+		native_wrapped_peer->_set_transfer_mode(p_packet.mode);
+		native_wrapped_peer->_set_transfer_channel(p_packet.channel);
+		Error err = native_wrapped_peer->_put_packet(p_packet.data.ptr(), p_packet.data.size());
+		ERR_FAIL_COND_MSG(err != OK, vformat("wrapped_peer->_put_packet() returned error: %s", UtilityFunctions::error_string(err)));
+		return;
+	}
+
+	if (!wrapped_target.valid || wrapped_target.peer != p_packet.peer) {
+		wrapped_peer->set_target_peer(p_packet.peer);
+	}
+	if (!wrapped_target.valid || wrapped_target.mode != p_packet.mode) {
+		wrapped_peer->set_transfer_mode(p_packet.mode);
+	}
+	if (!wrapped_target.valid || wrapped_target.channel != p_packet.channel) {
+		wrapped_peer->set_transfer_channel(p_packet.channel);
+	}
+	wrapped_target = { p_packet.peer, p_packet.mode, p_packet.channel, true };
+
+	// The wrapped peer copies the data out during put_packet(), so the buffer stays unshared and keeps its allocation.
+	send_buffer.resize(p_packet.data.size());
+	memcpy(send_buffer.ptrw(), p_packet.data.ptr(), p_packet.data.size());
+	Error err = wrapped_peer->put_packet(send_buffer);
+	ERR_FAIL_COND_MSG(err != OK, vformat("wrapped_peer->put_packet(send_buffer) returned error: %s", UtilityFunctions::error_string(err)));
+}
+
+void LaggyMultiplayerPeer::send_due(double p_time) {
+	send_channels.take_due(p_time, [&](LaggyPacket &packet) {
+		put_wrapped_packet(packet);
+	});
+}
+
+bool LaggyMultiplayerPeer::read_wrapped_packet(double p_time, Peer p_sender, LaggyPacket &r_packet) {
+	TransferMode packet_mode;
+	int32_t packet_channel;
+	LaggyPacketData data;
+	if (native_wrapped_peer) {
+		packet_mode = native_wrapped_peer->_get_packet_mode();
+		packet_channel = native_wrapped_peer->_get_packet_channel();
+		const uint8_t *buffer = nullptr;
+		int32_t buffer_size = 0;
+		Error err = native_wrapped_peer->_get_packet(&buffer, &buffer_size);
+		ERR_FAIL_COND_V_MSG(err != OK, false, vformat("wrapped_peer->_get_packet() returned error: %s", UtilityFunctions::error_string(err)));
+		data = packet_pool.copy(buffer, buffer_size);
+	} else {
+		packet_mode = wrapped_peer->get_packet_mode();
+		packet_channel = wrapped_peer->get_packet_channel();
+		PackedByteArray received = wrapped_peer->get_packet();
+		// get_packet() only returns an empty array for empty packets and errors, so the error is only checked then.
+		if (received.is_empty()) {
+			Error err = wrapped_peer->get_packet_error();
+			ERR_FAIL_COND_V_MSG(err != OK, false, vformat("wrapped_peer->get_packet_error() returned error: %s", UtilityFunctions::error_string(err)));
+		}
+		data = packet_pool.copy(received.ptr(), received.size());
+	}
+	ERR_FAIL_COND_V(data.is_null(), false);
+
+	r_packet = {
+		std::move(data),
+		packet_mode,
+		0,
+		packet_channel,
+		p_sender,
+		p_time,
+		p_time,
+	};
+	return true;
+}
+
+void LaggyMultiplayerPeer::receive_packet(LaggyPacket &&p_packet) {
+	LaggyPacketChannel &channel = receive_channels.get_channel(p_packet.peer, p_packet.channel);
+	if (!admit(receive_channels, channel, p_packet)) {
+		return;
+	}
+	channel.generate_sequence(p_packet);
+	channel.count_queued(p_packet);
+
+	double delay = 0.0;
+	bool drop_packet = false;
+	if (sample_rule(false, p_packet, *rng.ptr(), delay, drop_packet)) {
+		// Rules take over from the handler for the packets they match.
+	} else if (use_batch_handlers && handle_receive.is_valid()) {
+		batched_receive_packets.push_back(p_packet);
+		return;
+	} else if (handle_receive.is_valid()) {
+		call_handler(handle_receive, "handle_receive", p_packet.peer, p_packet.mode, p_packet.channel, p_packet.data.size(), delay, drop_packet);
+	} else {
+		get_random_delay(receive_channels, p_packet.time_of_delivery, delay, drop_packet);
+	}
+
+	if (trace_writer.is_open() || is_replaying()) {
+		trace(p_packet, LaggyTraceRecord::DIRECTION_RECEIVE, delay, drop_packet);
+	}
+	LaggyPacket duplicate;
+	bool duplicated = has_mutations() && mutate(p_packet, delay, drop_packet, duplicate);
+	schedule(std::move(p_packet), delay, drop_packet, retry_receive_packets, receive_channels, channel, *rng.ptr());
+	if (duplicated) {
+		schedule_duplicate(std::move(duplicate), delay, retry_receive_packets, receive_channels, channel);
+	}
+}
+
+void LaggyMultiplayerPeer::retry(LaggyPacketQueue &p_retry_packets, const Callable &p_custom_handler, const char *p_handler_name, LocalVector<LaggyPacket> &p_batched_packets, double p_time, LaggyChannelMap &p_channel_map) {
+	bool send = &p_channel_map == &send_channels;
+	bool batched = use_batch_handlers && p_custom_handler.is_valid();
+
+	while (p_retry_packets.has_due(p_time)) {
+		LaggyPacket packet = p_retry_packets.pop();
+		ERR_CONTINUE(packet.mode != TRANSFER_MODE_RELIABLE);
+
+		packet.time_of_delivery = p_time;
 
 		double delay = 0.0;
 		bool drop_packet = false;
-		if (p_custom_handler.is_valid()) {
+		if (sample_rule(send, packet, *rng.ptr(), delay, drop_packet)) {
+			// Rules take over from the handler for the packets they match.
+		} else if (batched) {
+			p_batched_packets.push_back(packet);
+			continue;
+		} else if (p_custom_handler.is_valid()) {
 			call_handler(p_custom_handler, p_handler_name, packet.peer, packet.mode, packet.channel, packet.data.size(), delay, drop_packet);
 		} else {
-			get_random_delay(delay, drop_packet);
+			get_random_delay(p_channel_map, p_time, delay, drop_packet);
 		}
 
-		packet.time_of_delivery = p_time + delay;
+		dispatch(std::move(packet), delay, drop_packet, dropped_retry_packets, p_channel_map);
+	}
 
-		if (drop_packet) {
-			retry_again.push_back(packet);
+	while (!dropped_retry_packets.is_empty()) {
+		p_retry_packets.push(dropped_retry_packets.pop());
+	}
+}
+
+void LaggyMultiplayerPeer::submit_delivery_request(DeliveryRequest &&p_request) {
+	// Requests only go through the queue once the overflow is empty, so they are never reordered.
+	if (overflow_requests.is_empty() && delivery_requests.try_push(std::move(p_request))) {
+		return;
+	}
+	overflow_requests.push_back(p_request);
+}
+
+void LaggyMultiplayerPeer::flush_overflow_requests() {
+	uint32_t flushed = 0;
+	while (flushed < overflow_requests.size() && delivery_requests.try_push(std::move(overflow_requests[flushed]))) {
+		flushed++;
+	}
+	for (uint32_t i = flushed; i < overflow_requests.size(); i++) {
+		overflow_requests[i - flushed] = overflow_requests[i];
+	}
+	overflow_requests.resize(overflow_requests.size() - flushed);
+}
+
+void LaggyMultiplayerPeer::process_delivery_request(DeliveryRequest &&p_request, RandomNumberGenerator &p_rng, LaggyPacketQueue &p_retry_packets) {
+	// Actions on the wrapped peer and the send side are carried out here, in order with the packets sent before them.
+	switch (p_request.type) {
+		case DeliveryRequest::SEND_PACKET:
+			break;
+		case DeliveryRequest::DISCONNECT_PEER:
+			wrapped_peer->disconnect_peer(int32_t(p_request.value), p_request.flag);
+			return;
+		case DeliveryRequest::SET_REFUSE_NEW_CONNECTIONS:
+			wrapped_peer->set_refuse_new_connections(p_request.flag);
+			return;
+		case DeliveryRequest::RESET_STATS:
+			send_channels.reset_stats();
+			return;
+		case DeliveryRequest::SET_SEED:
+			delivery_rng->set_seed(p_request.value);
+			return;
+	}
+
+	LaggyPacket &packet = p_request.packet;
+	// Packets sent while the delivery thread runs are sequenced here, in the order they were sent. Retried packets keep their sequence.
+	if (packet.retries == 0) {
+		LaggyPacketChannel &channel = send_channels.get_channel(packet.peer, packet.channel);
+		if (!admit(send_channels, channel, packet)) {
+			return;
+		}
+		channel.generate_sequence(packet);
+		channel.count_queued(packet);
+		schedule(std::move(packet), p_request.delay, p_request.flag, p_retry_packets, send_channels, channel, p_rng);
+		return;
+	}
+
+	// A retry can still be on its way from the main thread after its peer disconnected. It was counted as queued by the peer's slot,
+	// which was taken off the totals when the slot was erased, so it's dropped without giving the peer a slot again.
+	LaggyPacketChannel *channel = send_channels.find_channel(packet.peer, packet.channel);
+	if (!channel) {
+		send_channels.totals.dropped.add(1);
+		return;
+	}
+	schedule(std::move(packet), p_request.delay, p_request.flag, p_retry_packets, send_channels, *channel, p_rng);
+}
+
+void LaggyMultiplayerPeer::post_delivery_event(DeliveryEvent &&p_event) {
+	if (overflow_events.is_empty() && delivery_events.try_push(std::move(p_event))) {
+		return;
+	}
+	overflow_events.push_back(p_event);
+}
+
+void LaggyMultiplayerPeer::flush_overflow_events() {
+	uint32_t flushed = 0;
+	while (flushed < overflow_events.size() && delivery_events.try_push(std::move(overflow_events[flushed]))) {
+		flushed++;
+	}
+	for (uint32_t i = flushed; i < overflow_events.size(); i++) {
+		overflow_events[i - flushed] = overflow_events[i];
+	}
+	overflow_events.resize(overflow_events.size() - flushed);
+}
+
+void LaggyMultiplayerPeer::handle_delivery_event(DeliveryEvent &&p_event) {
+	switch (p_event.type) {
+		case DeliveryEvent::PACKET_RECEIVED:
+			receive_packet(std::move(p_event.packet));
+			break;
+		case DeliveryEvent::PACKET_DROPPED:
+			retry_send_packets.push(std::move(p_event.packet));
+			break;
+		case DeliveryEvent::PEER_CONNECTED:
+			add_peer(p_event.peer);
+			break;
+		case DeliveryEvent::PEER_DISCONNECTED:
+			remove_peer(p_event.peer);
+			break;
+	}
+}
+
+void LaggyMultiplayerPeer::handle_delivery_events() {
+	DeliveryEvent event;
+	while (delivery_events.try_pop(event)) {
+		handle_delivery_event(std::move(event));
+	}
+}
+
+void LaggyMultiplayerPeer::build_delivery_snapshot(DeliverySnapshot &r_snapshot) {
+	r_snapshot.peers.clear();
+	r_snapshot.channels.clear();
+	send_channels.for_each_peer([&](Peer p_peer, const LaggyLink &p_link, const LaggyQueueGauge &p_queued) {
+		r_snapshot.peers.insert(p_peer, { p_link, p_queued.packets.get(), p_queued.bytes.get() });
+	});
+	send_channels.for_each_channel([&](const LaggyPacketChannel &p_channel) {
+		DeliverySnapshot::ChannelState state;
+		state.peer = p_channel.get_peer();
+		state.channel = p_channel.get_id();
+		for (int mode = TRANSFER_MODE_UNRELIABLE; mode <= TRANSFER_MODE_RELIABLE; mode++) {
+			state.counters[mode] = p_channel.get_counters(TransferMode(mode));
+		}
+		r_snapshot.channels.push_back(state);
+	});
+	r_snapshot.next_time = send_channels.get_next_time();
+	r_snapshot.deadline_count = send_channels.get_deadline_count();
+}
+
+void LaggyMultiplayerPeer::publish_delivery_snapshot() {
+	// Built into the snapshot that isn't published, so the lock is only held to swap them.
+	uint32_t next = published_snapshot ^ 1;
+	build_delivery_snapshot(delivery_snapshots[next]);
+	MutexLock lock(*delivery_mutex.ptr());
+	published_snapshot = next;
+}
+
+void LaggyMultiplayerPeer::publish_delivery_status() {
+	delivery_connection_status.store(wrapped_peer->get_connection_status(), std::memory_order_release);
+	delivery_unique_id.store(wrapped_peer->get_unique_id(), std::memory_order_release);
+}
+
+void LaggyMultiplayerPeer::delivery_loop() {
+	while (!delivery_thread_exit.load(std::memory_order_acquire)) {
+		if (delivery_settings_changed.load(std::memory_order_acquire)) {
+			MutexLock lock(*delivery_mutex.ptr());
+			delivery_settings = pending_delivery_settings;
+			send_channels.link_settings = delivery_settings.send_link;
+			delivery_settings_changed.store(false, std::memory_order_relaxed);
+		}
+
+		DeliveryRequest request;
+		while (delivery_requests.try_pop(request)) {
+			process_delivery_request(std::move(request), *delivery_rng.ptr(), delivery_retry_packets);
+		}
+		while (!delivery_retry_packets.is_empty()) {
+			post_delivery_event({ DeliveryEvent::PACKET_DROPPED, delivery_retry_packets.pop() });
+		}
+
+		wrapped_peer->poll();
+		publish_delivery_status();
+		if (delivery_connection_status.load(std::memory_order_relaxed) == CONNECTION_CONNECTED) {
+			send_due(get_time());
+
+			// Stamped with the time they were actually received, instead of the next poll of the main thread.
+			LaggyPacket packet;
+			int32_t available = get_wrapped_packet_count();
+			while (available > 0) {
+				if (read_wrapped_packet(get_time(), get_wrapped_packet_peer(), packet)) {
+					post_delivery_event({ DeliveryEvent::PACKET_RECEIVED, std::move(packet) });
+				}
+				if (--available == 0) {
+					available = get_wrapped_packet_count();
+				}
+			}
+		}
+
+		flush_overflow_events();
+		if (delivery_snapshot_requested.exchange(false, std::memory_order_acq_rel)) {
+			publish_delivery_snapshot();
+		}
+
+		double next_time = send_channels.get_next_time();
+		double wait = Math::min(next_time - get_time(), DELIVERY_THREAD_MAX_WAIT);
+		if (wait > 0.0) {
+			OS::get_singleton()->delay_usec(int32_t(wait * 1'000'000.0));
+		}
+	}
+}
+
+void LaggyMultiplayerPeer::start_delivery_thread() {
+	ERR_FAIL_COND(delivery_thread.is_valid() || wrapped_peer.is_null());
+	if (!delivery_requests.is_initialized()) {
+		delivery_requests.init(DELIVERY_QUEUE_SIZE);
+		delivery_events.init(DELIVERY_QUEUE_SIZE);
+	}
+	// Received packets are allocated by the delivery thread, and released by the main thread.
+	packet_pool.set_thread_safe(true);
+	delivery_thread_exit.store(false, std::memory_order_release);
+
+	// Everything the main thread reads while the thread runs starts out from the current state.
+	delivery_settings = settings;
+	delivery_settings_changed.store(false, std::memory_order_relaxed);
+	build_delivery_snapshot(delivery_snapshots[published_snapshot]);
+	delivery_snapshot_requested.store(false, std::memory_order_relaxed);
+	publish_delivery_status();
+	delivery_refusing_new_connections.store(wrapped_peer->is_refusing_new_connections(), std::memory_order_relaxed);
+	delivery_server_relay_supported = wrapped_peer->is_server_relay_supported();
+
+	delivery_thread = Ref<Thread>(memnew(Thread));
+	Error err = delivery_thread->start(callable_mp(this, &LaggyMultiplayerPeer::delivery_loop), Thread::PRIORITY_HIGH);
+	if (err != OK) {
+		delivery_thread = Ref<Thread>();
+		packet_pool.set_thread_safe(false);
+		ERR_FAIL_MSG(vformat("Failed to start the delivery thread: %s", UtilityFunctions::error_string(err)));
+	}
+}
+
+void LaggyMultiplayerPeer::stop_delivery_thread(bool p_hand_over) {
+	if (delivery_thread.is_null()) {
+		return;
+	}
+	delivery_thread_exit.store(true, std::memory_order_release);
+	delivery_thread->wait_to_finish();
+	delivery_thread = Ref<Thread>();
+	packet_pool.set_thread_safe(false);
+	// Settings changed after the thread last picked them up.
+	send_channels.link_settings = settings.send_link;
+
+	// The send side is back on the main thread, which takes over whatever the delivery thread didn't get to.
+	DeliveryEvent event;
+	while (delivery_events.try_pop(event)) {
+		if (p_hand_over) {
+			handle_delivery_event(std::move(event));
+		}
+	}
+	for (DeliveryEvent &overflow_event : overflow_events) {
+		if (p_hand_over) {
+			handle_delivery_event(std::move(overflow_event));
+		}
+	}
+	overflow_events.clear();
+
+	DeliveryRequest request;
+	while (delivery_requests.try_pop(request)) {
+		if (p_hand_over) {
+			process_delivery_request(std::move(request), *rng.ptr(), retry_send_packets);
+		}
+	}
+	for (DeliveryRequest &overflow_request : overflow_requests) {
+		if (p_hand_over) {
+			process_delivery_request(std::move(overflow_request), *rng.ptr(), retry_send_packets);
+		}
+	}
+	overflow_requests.clear();
+
+	while (!delivery_retry_packets.is_empty()) {
+		LaggyPacket packet = delivery_retry_packets.pop();
+		if (p_hand_over) {
+			retry_send_packets.push(std::move(packet));
+		}
+	}
+}
+
+// Spreads the peer over the whole seed, so the streams of peers with close IDs aren't correlated.
+static uint64_t get_stream_seed(uint64_t p_seed, uint64_t p_peer) {
+	uint64_t z = p_seed + (p_peer + 1) * 0x9e3779b97f4a7c15;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+	return z ^ (z >> 31);
+}
+
+bool LaggyMultiplayerPeer::can_process_in_parallel(bool p_send) const {
+	// Mutations draw from a single stream, in the order packets are delivered, which only holds on one thread.
+	if (!use_worker_threads || trace_writer.is_open() || is_replaying() || has_mutations()) {
+		return false;
+	}
+	// Handlers are called on the calling thread, and the delivery thread already owns the send side.
+	if (p_send) {
+		return !handle_send.is_valid() && delivery_thread.is_null();
+	}
+	return !handle_receive.is_valid();
+}
+
+void LaggyMultiplayerPeer::process_in_parallel(bool p_send, double p_time) {
+	LaggyChannelMap &channel_map = p_send ? send_channels : receive_channels;
+	LaggyPacketQueue &retry_packets = p_send ? retry_send_packets : retry_receive_packets;
+	LocalVector<PeerTask> &tasks = p_send ? send_tasks : receive_tasks;
+
+	// The tasks only read the profile and scenario, so they are brought up to date first.
+	advance_conditions(channel_map, p_time);
+
+	// Peers that don't have a slot yet get one here, since the tasks can't add them.
+	while (retry_packets.has_due(p_time)) {
+		LaggyPacket packet = retry_packets.pop();
+		packet.time_of_delivery = p_time;
+		uint32_t slot = channel_map.add_peer(packet.peer);
+		if (slot >= tasks.size()) {
+			tasks.resize(channel_map.get_slot_count());
+		}
+		tasks[slot].retries.push_back(std::move(packet));
+	}
+	tasks.resize(channel_map.get_slot_count());
+	if (tasks.is_empty()) {
+		return;
+	}
+	// Only the channels with packets due are visited, so the tasks don't scan every channel of their peer.
+	channel_map.claim_due(p_time, [&](uint32_t p_slot, Channel p_channel) {
+		tasks[p_slot].channels.push_back(p_channel);
+	});
+
+	for (uint32_t i = 0; i < tasks.size(); i++) {
+		PeerTask &task = tasks[i];
+		if (!channel_map.is_slot_used(i) || task.peer == channel_map.get_slot_peer(i)) {
+			continue;
+		}
+		// Seeded from the peer rather than the slot, so the stream doesn't depend on the order peers connected in.
+		task.peer = channel_map.get_slot_peer(i);
+		if (task.rng.is_null()) {
+			task.rng.instantiate();
+		}
+		task.rng->set_seed(get_stream_seed(rng->get_seed() + (p_send ? 0 : 1), uint32_t(task.peer)));
+		task.impairment_state = {};
+	}
+
+	parallel_send = p_send;
+	parallel_time = p_time;
+	WorkerThreadPool *pool = WorkerThreadPool::get_singleton();
+	int64_t group = pool->add_native_group_task(&LaggyMultiplayerPeer::process_peer_task_callback, this, tasks.size(), -1, true, "LaggyMultiplayerPeer");
+	pool->wait_for_group_task_completion(group);
+
+	// Merged in slot order, so the results don't depend on which task finished first.
+	for (uint32_t i = 0; i < tasks.size(); i++) {
+		PeerTask &task = tasks[i];
+		for (LaggyPacket &packet : task.retries) {
+			channel_map.get_slot_channel(i, packet.channel).count_dropped(packet, true);
+			retry_packets.push(std::move(packet));
+		}
+		task.retries.clear();
+		for (double delay : task.delays) {
+			channel_map.delay_histogram.record(delay);
+		}
+		task.delays.clear();
+
+		if (p_send) {
+			channel_map.finish_slot(i, p_time, task.channels, task.due, task.discarded, [&](LaggyPacket &packet) {
+				put_wrapped_packet(packet);
+			});
 		} else {
-			p_channel_map[packet.peer][packet.channel].push(packet);
+			channel_map.finish_slot(i, p_time, task.channels, task.due, task.discarded, [&](LaggyPacket &packet) {
+				available_bytes += packet.data.size();
+				available_packets.push_back(std::move(packet));
+			});
+		}
+	}
+}
+
+void LaggyMultiplayerPeer::process_peer_task(uint32_t p_slot) {
+	LaggyChannelMap &channel_map = parallel_send ? send_channels : receive_channels;
+	PeerTask &task = (parallel_send ? send_tasks : receive_tasks)[p_slot];
+	if (!channel_map.is_slot_used(p_slot)) {
+		return;
+	}
+
+	// Sent packets are taken before retrying, and received packets after, in the same order as a serial poll.
+	if (parallel_send) {
+		channel_map.take_slot_due(p_slot, task.channels, parallel_time, task.due, task.discarded);
+	}
+
+	// Like schedule(), but leaves everything shared with other peers to process_in_parallel().
+	uint32_t dropped = 0;
+	for (uint32_t i = 0; i < task.retries.size(); i++) {
+		LaggyPacket &packet = task.retries[i];
+		double delay = 0.0;
+		bool drop_packet = false;
+		if (!sample_rule(parallel_send, packet, *task.rng.ptr(), delay, drop_packet)) {
+			sample_delay(parallel_send, *task.rng.ptr(), task.impairment_state, delay, drop_packet);
+		}
+
+		LaggyPacketChannel &channel = channel_map.get_slot_channel(p_slot, packet.channel);
+		double departure = packet.time_of_delivery;
+		if (!drop_packet && !channel_map.transmit(channel, *task.rng.ptr(), packet.time_of_delivery, packet.data.size(), departure)) {
+			drop_packet = true;
+		}
+
+		if (drop_packet) {
+			packet.time_of_delivery += get_retry_wait(settings, delay, packet.retries);
+			packet.retries++;
+			if (dropped != i) {
+				task.retries[dropped] = std::move(packet);
+			}
+			dropped++;
+			continue;
+		}
+
+		task.delays.push_back(departure + delay - packet.time_of_delivery);
+		packet.time_of_delivery = departure + delay;
+		if (!task.channels.has(packet.channel)) {
+			task.channels.push_back(packet.channel);
+		}
+		channel.push(std::move(packet));
+	}
+	task.retries.resize(dropped);
+
+	if (!parallel_send) {
+		channel_map.take_slot_due(p_slot, task.channels, parallel_time, task.due, task.discarded);
+	}
+}
+
+void LaggyMultiplayerPeer::process_peer_task_callback(void *p_userdata, uint32_t p_slot) {
+	static_cast<LaggyMultiplayerPeer *>(p_userdata)->process_peer_task(p_slot);
+}
+
+Error LaggyMultiplayerPeer::load_profile(const String &p_path, bool p_send) {
+	// Played from the start, beginning now.
+	Error err = (p_send ? send_profile : receive_profile).open(p_path, get_time());
+	ERR_FAIL_COND_V_MSG(err != OK, err, vformat("Failed to load profile trace %s: %s", p_path, UtilityFunctions::error_string(err)));
+	return OK;
+}
+
+Error LaggyMultiplayerPeer::start_recording(const String &p_path, bool p_include_payload) {
+	Error err = trace_writer.open(p_path, p_include_payload);
+	ERR_FAIL_COND_V_MSG(err != OK, err, vformat("Failed to open trace file %s for recording: %s", p_path, UtilityFunctions::error_string(err)));
+	return OK;
+}
+
+Error LaggyMultiplayerPeer::start_replay(const String &p_path) {
+	stop_replay();
+	for (int direction = 0; direction < 2; direction++) {
+		Error err = replay_readers[direction].open(p_path, LaggyTraceRecord::Direction(direction));
+		if (err != OK) {
+			stop_replay();
+			ERR_FAIL_V_MSG(err, vformat("Failed to open trace file %s for replay: %s", p_path, UtilityFunctions::error_string(err)));
 		}
 	}
+	return OK;
+}
+
+void LaggyMultiplayerPeer::stop_replay() {
+	for (LaggyTraceReader &replay_reader : replay_readers) {
+		replay_reader.close();
+	}
+	replay_diverged = false;
+}
 
-	p_retry_packets = retry_again;
+void LaggyMultiplayerPeer::set_use_delivery_thread(bool p_enabled) {
+	ERR_FAIL_COND_MSG(p_enabled && clock_mode == CLOCK_MANUAL, "The delivery thread can't be used when clock_mode is CLOCK_MANUAL.");
+	// Takes effect on the next poll, once sent packets are no longer waiting for the batch handler.
+	use_delivery_thread = p_enabled;
 }
 
 Ref<LaggyMultiplayerPeer> LaggyMultiplayerPeer::create(const Ref<MultiplayerPeer> &p_wrapped_peer, double p_delay_minimum, double p_delay_maximum, double p_packet_loss) {
@@ -113,197 +987,723 @@ void LaggyMultiplayerPeer::drop_packet() {
 	drop_requested = true;
 }
 
+double LaggyMultiplayerPeer::get_next_delivery_time() {
+	if (!batched_send_packets.is_empty() || !batched_receive_packets.is_empty()) {
+		return get_time();
+	}
+	double send_time;
+	if (delivery_thread.is_valid()) {
+		MutexLock lock(*delivery_mutex.ptr());
+		send_time = delivery_snapshots[published_snapshot].next_time;
+	} else {
+		send_time = send_channels.get_next_time();
+	}
+	double next_time = Math::min(send_time, receive_channels.get_next_time());
+	next_time = Math::min(next_time, Math::min(retry_send_packets.get_next_time(), retry_receive_packets.get_next_time()));
+	return next_time == Math_INF ? -1.0 : next_time;
+}
+
 void LaggyMultiplayerPeer::set_wrapped_peer(const Ref<MultiplayerPeer> &p_peer) {
 	if (p_peer == wrapped_peer) {
 		return;
 	}
+	// Restarted on the next poll if enabled. Queued packets are dropped below anyway.
+	stop_delivery_thread(false);
 	if (wrapped_peer.is_valid()) {
 		wrapped_peer->disconnect("peer_connected", callable_mp(this, &LaggyMultiplayerPeer::on_peer_connected));
 		wrapped_peer->disconnect("peer_disconnected", callable_mp(this, &LaggyMultiplayerPeer::on_peer_disconnected));
 	}
 	wrapped_peer = p_peer;
+	// Peers of other extensions are only reachable through Godot, even if they inherit MultiplayerPeerExtension too.
+	native_wrapped_peer = nullptr;
+	if (LaggyHubPeer *hub_peer = Object::cast_to<LaggyHubPeer>(wrapped_peer.ptr())) {
+		native_wrapped_peer = hub_peer;
+	} else if (LaggyLoopbackPeer *loopback_peer = Object::cast_to<LaggyLoopbackPeer>(wrapped_peer.ptr())) {
+		native_wrapped_peer = loopback_peer;
+	} else if (LaggyMultiplayerPeer *laggy_peer = Object::cast_to<LaggyMultiplayerPeer>(wrapped_peer.ptr())) {
+		native_wrapped_peer = laggy_peer;
+	}
+	wrapped_target = {};
 	if (wrapped_peer.is_valid()) {
 		wrapped_peer->connect("peer_connected", callable_mp(this, &LaggyMultiplayerPeer::on_peer_connected));
 		wrapped_peer->connect("peer_disconnected", callable_mp(this, &LaggyMultiplayerPeer::on_peer_disconnected));
 	}
+	connected_peers.clear();
 	send_channels.clear();
 	receive_channels.clear();
+	send_tasks.clear();
+	receive_tasks.clear();
+	retry_send_packets.clear();
+	retry_receive_packets.clear();
+	batched_send_packets.clear();
+	batched_receive_packets.clear();
 	available_packets.clear();
+	available_bytes = 0;
+	holding_current_packet = false;
 }
 
 Ref<MultiplayerPeer> LaggyMultiplayerPeer::get_wrapped_peer() const {
 	return wrapped_peer;
 }
 
+Dictionary LaggyMultiplayerPeer::get_stats() const {
+	PackedInt32Array peers;
+	PackedInt32Array channels;
+	PackedInt32Array modes;
+	PackedByteArray sent;
+	PackedInt64Array packets;
+	PackedInt64Array bytes;
+	PackedInt64Array delivered;
+	PackedInt64Array dropped;
+	PackedInt64Array retried;
+	PackedInt64Array queued_packets;
+	PackedInt64Array queued_bytes;
+
+	auto add_channel = [&](bool p_send, Peer p_peer, Channel p_channel, const LaggyTrafficCounters *p_counters) {
+		for (int mode = TRANSFER_MODE_UNRELIABLE; mode <= TRANSFER_MODE_RELIABLE; mode++) {
+			const LaggyTrafficCounters &counters = p_counters[mode];
+			if (counters.packets.get() == 0 && counters.queued_packets.get() == 0) {
+				continue;
+			}
+			peers.push_back(p_peer);
+			channels.push_back(p_channel);
+			modes.push_back(mode);
+			sent.push_back(p_send);
+			packets.push_back(counters.packets.get());
+			bytes.push_back(counters.bytes.get());
+			delivered.push_back(counters.delivered.get());
+			dropped.push_back(counters.dropped.get());
+			retried.push_back(counters.retried.get());
+			queued_packets.push_back(counters.queued_packets.get());
+			queued_bytes.push_back(counters.queued_bytes.get());
+		}
+	};
+
+	if (delivery_thread.is_valid()) {
+		// The send channels can be reallocated by the delivery thread at any time, so they are read from its last snapshot.
+		MutexLock lock(*delivery_mutex.ptr());
+		for (const DeliverySnapshot::ChannelState &state : delivery_snapshots[published_snapshot].channels) {
+			add_channel(true, state.peer, state.channel, state.counters);
+		}
+	} else {
+		send_channels.for_each_channel([&](const LaggyPacketChannel &p_channel) {
+			add_channel(true, p_channel.get_peer(), p_channel.get_id(), &p_channel.get_counters(TRANSFER_MODE_UNRELIABLE));
+		});
+	}
+	receive_channels.for_each_channel([&](const LaggyPacketChannel &p_channel) {
+		add_channel(false, p_channel.get_peer(), p_channel.get_id(), &p_channel.get_counters(TRANSFER_MODE_UNRELIABLE));
+	});
+
+	Dictionary stats;
+	stats["peer"] = peers;
+	stats["channel"] = channels;
+	stats["mode"] = modes;
+	stats["send"] = sent;
+	stats["packets"] = packets;
+	stats["bytes"] = bytes;
+	stats["delivered"] = delivered;
+	stats["dropped"] = dropped;
+	stats["retried"] = retried;
+	stats["queued_packets"] = queued_packets;
+	stats["queued_bytes"] = queued_bytes;
+	return stats;
+}
+
+void LaggyMultiplayerPeer::reset_stats() {
+	if (delivery_thread.is_valid()) {
+		submit_delivery_request({ DeliveryRequest::RESET_STATS, LaggyPacket(), 0.0, false, 0 });
+	} else {
+		send_channels.reset_stats();
+	}
+	receive_channels.reset_stats();
+}
+
+double LaggyMultiplayerPeer::get_delay_percentile(double p_percentile, bool p_send) const {
+	const LaggyChannelMap &channels = p_send ? send_channels : receive_channels;
+	return channels.delay_histogram.get_percentile(p_percentile);
+}
+
+double LaggyMultiplayerPeer::get_residence_percentile(double p_percentile, bool p_send) const {
+	const LaggyChannelMap &channels = p_send ? send_channels : receive_channels;
+	return channels.residence_histogram.get_percentile(p_percentile);
+}
+
+double LaggyMultiplayerPeer::get_monitor_value(int32_t p_monitor) const {
+	switch (Monitor(p_monitor)) {
+		case MONITOR_QUEUED_PACKETS:
+			return send_channels.totals.queued_packets.get() + receive_channels.totals.queued_packets.get();
+		case MONITOR_QUEUED_BYTES:
+			return send_channels.totals.queued_bytes.get() + receive_channels.totals.queued_bytes.get();
+		case MONITOR_SENT_PACKETS:
+			return send_channels.totals.delivered.get();
+		case MONITOR_RECEIVED_PACKETS:
+			return receive_channels.totals.delivered.get();
+		case MONITOR_DROPPED_PACKETS:
+			return send_channels.totals.dropped.get() + receive_channels.totals.dropped.get();
+		case MONITOR_RETRIED_PACKETS:
+			return send_channels.totals.retried.get() + receive_channels.totals.retried.get();
+		case MONITOR_SEND_DELAY_P99:
+			return send_channels.delay_histogram.get_percentile(0.99) * 1000.0;
+		case MONITOR_RECEIVE_DELAY_P99:
+			return receive_channels.delay_histogram.get_percentile(0.99) * 1000.0;
+		case MONITOR_MAX:
+			break;
+	}
+	return 0.0;
+}
+
+void LaggyMultiplayerPeer::update_monitors(const String &p_category) {
+	Performance *performance = Performance::get_singleton();
+	if (!performance) {
+		return;
+	}
+	if (!monitor_category.is_empty()) {
+		for (int i = 0; i < MONITOR_MAX; i++) {
+			StringName id = monitor_category + "/" + monitor_names[i];
+			if (performance->has_custom_monitor(id)) {
+				performance->remove_custom_monitor(id);
+			}
+		}
+	}
+	monitor_category = p_category;
+	if (!monitor_category.is_empty()) {
+		for (int i = 0; i < MONITOR_MAX; i++) {
+			Array arguments;
+			arguments.push_back(i);
+			performance->add_custom_monitor(monitor_category + "/" + monitor_names[i], callable_mp(this, &LaggyMultiplayerPeer::get_monitor_value), arguments);
+		}
+	}
+}
+
+void LaggyMultiplayerPeer::set_clock_mode(ClockMode p_mode) {
+	if (p_mode == clock_mode) {
+		return;
+	}
+	ERR_FAIL_COND_MSG(p_mode == CLOCK_MANUAL && (use_delivery_thread || delivery_thread.is_valid()), "The manual clock can't be used with the delivery thread.");
+	// Continue from the current time, so packets that are already queued keep their delays.
+	manual_time = get_real_time();
+	clock_mode = p_mode;
+}
+
+void LaggyMultiplayerPeer::advance_time(double p_seconds) {
+	ERR_FAIL_COND_MSG(clock_mode != CLOCK_MANUAL, "Time can only be advanced when clock_mode is CLOCK_MANUAL.");
+	ERR_FAIL_COND(p_seconds < 0.0);
+	manual_time += p_seconds;
+}
+
+void LaggyMultiplayerPeer::set_seed(uint64_t p_seed) {
+	rng->set_seed(p_seed);
+	if (delivery_thread.is_valid()) {
+		submit_delivery_request({ DeliveryRequest::SET_SEED, LaggyPacket(), 0.0, false, p_seed + 1 });
+	} else {
+		delivery_rng->set_seed(p_seed + 1);
+	}
+	mutation_rng->set_seed(p_seed + 2);
+	send_impairment_state = {};
+	receive_impairment_state = {};
+	// Reseeded on their next pass.
+	for (PeerTask &task : send_tasks) {
+		task.peer = 0;
+	}
+	for (PeerTask &task : receive_tasks) {
+		task.peer = 0;
+	}
+}
+
+void LaggyMultiplayerPeer::set_retry_timeout(double p_value) {
+	settings.retry_timeout = Math::max(p_value, 0.0);
+	update_delivery_settings();
+}
+
+void LaggyMultiplayerPeer::set_retry_backoff(double p_value) {
+	settings.retry_backoff = Math::max(p_value, 1.0);
+	update_delivery_settings();
+}
+
+void LaggyMultiplayerPeer::set_retry_timeout_maximum(double p_value) {
+	settings.retry_timeout_maximum = Math::max(p_value, 0.0);
+	update_delivery_settings();
+}
+
+void LaggyMultiplayerPeer::set_send_bandwidth(double p_bytes_per_second) {
+	send_bandwidth = Math::max(p_bytes_per_second, 0.0);
+	if (!send_profile.is_open() && !has_scenario()) {
+		apply_bandwidth(true, -1.0);
+	}
+}
+
+void LaggyMultiplayerPeer::set_receive_bandwidth(double p_bytes_per_second) {
+	receive_bandwidth = Math::max(p_bytes_per_second, 0.0);
+	if (!receive_profile.is_open() && !has_scenario()) {
+		apply_bandwidth(false, -1.0);
+	}
+}
+
+void LaggyMultiplayerPeer::set_max_queued_packets(int64_t p_packets) {
+	settings.queue_limits.max_packets = Math::max<int64_t>(p_packets, 0);
+	update_delivery_settings();
+}
+
+void LaggyMultiplayerPeer::set_max_queued_bytes(int64_t p_bytes) {
+	settings.queue_limits.max_bytes = Math::max<int64_t>(p_bytes, 0);
+	update_delivery_settings();
+}
+
+void LaggyMultiplayerPeer::set_max_queued_packets_per_peer(int64_t p_packets) {
+	settings.queue_limits.max_peer_packets = Math::max<int64_t>(p_packets, 0);
+	update_delivery_settings();
+}
+
+void LaggyMultiplayerPeer::set_max_queued_bytes_per_peer(int64_t p_bytes) {
+	settings.queue_limits.max_peer_bytes = Math::max<int64_t>(p_bytes, 0);
+	update_delivery_settings();
+}
+
+void LaggyMultiplayerPeer::set_queue_overflow_policy(QueueOverflowPolicy p_policy) {
+	settings.queue_overflow_policy = p_policy;
+	update_delivery_settings();
+}
+
+Dictionary LaggyMultiplayerPeer::get_memory_usage() const {
+	Dictionary usage;
+	usage["send_queued_packets"] = int64_t(send_channels.totals.queued_packets.get());
+	usage["send_queued_bytes"] = int64_t(send_channels.totals.queued_bytes.get());
+	usage["receive_queued_packets"] = int64_t(receive_channels.totals.queued_packets.get());
+	usage["receive_queued_bytes"] = int64_t(receive_channels.totals.queued_bytes.get());
+	usage["available_packets"] = int64_t(available_packets.size());
+	usage["available_bytes"] = int64_t(available_bytes);
+	if (delivery_thread.is_valid()) {
+		MutexLock lock(*delivery_mutex.ptr());
+		usage["send_deadlines"] = int64_t(delivery_snapshots[published_snapshot].deadline_count);
+	} else {
+		usage["send_deadlines"] = int64_t(send_channels.get_deadline_count());
+	}
+	usage["receive_deadlines"] = int64_t(receive_channels.get_deadline_count());
+	return usage;
+}
+
+PackedFloat64Array LaggyMultiplayerPeer::get_poll_samples() const {
+	PackedFloat64Array durations;
+	durations.resize(poll_profiler.get_sample_count() * POLL_PHASE_MAX);
+	double *ptr = durations.ptrw();
+	for (uint32_t i = 0; i < poll_profiler.get_sample_count(); i++) {
+		const LaggyPollProfiler::Sample &sample = poll_profiler.get_sample(i);
+		for (uint32_t phase = 0; phase < POLL_PHASE_MAX; phase++) {
+			ptr[i * POLL_PHASE_MAX + phase] = sample.duration[phase] / 1e9;
+		}
+	}
+	return durations;
+}
+
+double LaggyMultiplayerPeer::get_poll_phase_percentile(PollPhase p_phase, double p_percentile) const {
+	ERR_FAIL_INDEX_V(p_phase, POLL_PHASE_MAX, 0.0);
+	return poll_profiler.get_percentile(p_phase, p_percentile) / 1e9;
+}
+
+Error LaggyMultiplayerPeer::save_poll_trace(const String &p_path) const {
+	return poll_profiler.save_chrome_trace(p_path, poll_phase_names, POLL_PHASE_MAX);
+}
+
+void LaggyMultiplayerPeer::set_corruption_bit_rate(double p_rate) {
+	// Each bit is flipped by and-ing random words together, so the highest rate is one of them alone, 1/2.
+	corruption_bit_rate = Math::clamp(p_rate, 0.0, 0.5);
+	corruption_rate_shift = LaggyCorruption::get_rate_shift(corruption_bit_rate);
+}
+
+void LaggyMultiplayerPeer::set_link_burst(int32_t p_bytes) {
+	settings.send_link.burst = Math::max(p_bytes, 0);
+	receive_channels.link_settings.burst = settings.send_link.burst;
+	update_delivery_settings();
+}
+
+void LaggyMultiplayerPeer::set_link_queue_size(int32_t p_bytes) {
+	settings.send_link.queue_size = Math::max(p_bytes, 0);
+	receive_channels.link_settings.queue_size = settings.send_link.queue_size;
+	update_delivery_settings();
+}
+
+void LaggyMultiplayerPeer::set_link_queue_policy(LinkQueuePolicy p_policy) {
+	settings.send_link.random_early_detection = p_policy == LINK_QUEUE_RED;
+	receive_channels.link_settings.random_early_detection = settings.send_link.random_early_detection;
+	update_delivery_settings();
+}
+
+void LaggyMultiplayerPeer::set_link_mtu(int32_t p_bytes) {
+	settings.send_link.mtu = Math::max(p_bytes, 0);
+	receive_channels.link_settings.mtu = settings.send_link.mtu;
+	update_delivery_settings();
+}
+
+void LaggyMultiplayerPeer::set_link_overhead(int32_t p_bytes) {
+	settings.send_link.overhead = Math::max(p_bytes, 0);
+	receive_channels.link_settings.overhead = settings.send_link.overhead;
+	update_delivery_settings();
+}
+
+double LaggyMultiplayerPeer::get_link_backlog(int32_t p_peer, bool p_send) const {
+	if (p_send && delivery_thread.is_valid()) {
+		MutexLock lock(*delivery_mutex.ptr());
+		const DeliverySnapshot::PeerState *state = delivery_snapshots[published_snapshot].peers.getptr(p_peer);
+		return state ? state->link.get_backlog(settings.send_link, get_time()) : 0.0;
+	}
+	const LaggyChannelMap &channels = p_send ? send_channels : receive_channels;
+	return channels.get_link_backlog(p_peer, get_time());
+}
+
+void LaggyMultiplayerPeer::set_scenario(const Ref<LaggyScenario> &p_scenario) {
+	scenario = p_scenario;
+	restart_scenario();
+}
+
+void LaggyMultiplayerPeer::restart_scenario() {
+	scenario_start_time = get_time();
+	scenario_cursor = {};
+	scenario_conditions = {};
+	if (has_scenario()) {
+		scenario->sample(0.0, scenario_cursor, scenario_conditions);
+	}
+}
+
+void LaggyMultiplayerPeer::set_impairment(const Ref<LaggyImpairment> &p_impairment) {
+	impairment = p_impairment;
+	send_impairment_state = {};
+	receive_impairment_state = {};
+	for (PeerTask &task : send_tasks) {
+		task.impairment_state = {};
+	}
+	for (PeerTask &task : receive_tasks) {
+		task.impairment_state = {};
+	}
+}
+
 Error LaggyMultiplayerPeer::_get_packet(const uint8_t **r_buffer, int32_t *r_buffer_size) {
-	ERR_FAIL_COND_V(available_packets.size() == 0, ERR_UNAVAILABLE);
-	current_packet = available_packets[0];
-	*r_buffer = current_packet.data.ptrw();
-	*r_buffer_size = current_packet.data.size();
-	available_packets.remove_at(0);
+	release_current_packet();
+	ERR_FAIL_COND_V(available_packets.is_empty(), ERR_UNAVAILABLE);
+	const LaggyPacket &packet = available_packets.front();
+	*r_buffer = packet.data.ptr();
+	*r_buffer_size = packet.data.size();
+	holding_current_packet = true;
 	return OK;
 }
 
-Error LaggyMultiplayerPeer::_put_packet(const uint8_t *p_buffer, int32_t p_buffer_size) {
-	ERR_FAIL_COND_V(wrapped_peer.is_null(), ERR_UNCONFIGURED);
-	ERR_FAIL_COND_V(target_peer <= 0, ERR_INVALID_PARAMETER);
+bool LaggyMultiplayerPeer::has_room(const LaggyChannelMap &p_channel_map, Peer p_peer, int32_t p_size, uint64_t p_extra_packets) const {
+	// Packets waiting to be read still take memory, so they count towards the received packets.
+	bool receiving = &p_channel_map == &receive_channels;
+	uint64_t extra_packets = p_extra_packets + (receiving ? available_packets.size() : 0);
+	uint64_t extra_bytes = p_extra_packets * p_size + (receiving ? available_bytes : 0);
+	const LaggyQueueLimits &limits = get_settings(p_channel_map).queue_limits;
+	return p_channel_map.has_peer_room(limits, p_peer, p_size) && p_channel_map.has_total_room(limits, p_size, extra_packets, extra_bytes);
+}
 
-	double delay = 0.0;
-	bool drop_packet = false;
-	if (handle_send.is_valid()) {
-		call_handler(handle_send, "handle_send", target_peer, transfer_mode, transfer_channel, p_buffer_size, delay, drop_packet);
-	} else {
-		get_random_delay(delay, drop_packet);
+bool LaggyMultiplayerPeer::has_send_room(Peer p_peer, int32_t p_size, uint64_t p_extra_packets) const {
+	if (delivery_thread.is_null()) {
+		return has_room(send_channels, p_peer, p_size, p_extra_packets);
+	}
+	// The totals can be read from any thread, but the queues of each peer are only known from the last snapshot.
+	const DeliverySnapshot::PeerState *state = delivery_snapshots[published_snapshot].peers.getptr(p_peer);
+	if (!settings.queue_limits.has_peer_room(state ? state->queued_packets : 0, state ? state->queued_bytes : 0, p_size)) {
+		return false;
+	}
+	return send_channels.has_total_room(settings.queue_limits, p_size, p_extra_packets, p_extra_packets * p_size);
+}
+
+bool LaggyMultiplayerPeer::admit(LaggyChannelMap &p_channel_map, LaggyPacketChannel &p_channel, const LaggyPacket &p_packet) {
+	const PipelineSettings &pipeline_settings = get_settings(p_channel_map);
+	if (!pipeline_settings.queue_limits.is_limited()) {
+		return true;
+	}
+	int32_t size = p_packet.data.size();
+	while (!has_room(p_channel_map, p_packet.peer, size, 0)) {
+		if (pipeline_settings.queue_overflow_policy != QUEUE_OVERFLOW_DROP_OLDEST_UNRELIABLE) {
+			break;
+		}
+		// Makes room within the peer's own packets when it is the peer's cap that was reached.
+		bool peer_full = !p_channel_map.has_peer_room(pipeline_settings.queue_limits, p_packet.peer, size);
+		if (!p_channel_map.evict_unreliable(peer_full ? p_packet.peer : 0)) {
+			break;
+		}
+	}
+	if (has_room(p_channel_map, p_packet.peer, size, 0)) {
+		return true;
+	}
+	// Counted as queued and dropped right away, so overflows show up in the statistics.
+	p_channel.count_queued(p_packet);
+	p_channel.count_dropped(p_packet, false);
+	return false;
+}
+
+bool LaggyMultiplayerPeer::can_send(int32_t p_size) const {
+	if (settings.queue_overflow_policy != QUEUE_OVERFLOW_BACKPRESSURE || !settings.queue_limits.is_limited()) {
+		return true;
 	}
+	// The lock only guards the snapshot, so sending without the delivery thread doesn't take it.
+	if (delivery_thread.is_null()) {
+		return has_target_room(p_size);
+	}
+	MutexLock lock(*delivery_mutex.ptr());
+	return has_target_room(p_size);
+}
+
+bool LaggyMultiplayerPeer::has_target_room(int32_t p_size) const {
+	if (target_peer > 0) {
+		return has_send_room(target_peer, p_size, 0);
+	}
+	uint64_t targets = 0;
+	for (Peer peer : connected_peers) {
+		if (peer != -target_peer && !has_send_room(peer, p_size, targets++)) {
+			return false;
+		}
+	}
+	return true;
+}
 
-	PackedByteArray data;
-	Error err = static_cast<Error>(data.resize(p_buffer_size));
-	ERR_FAIL_COND_V(err != OK, err);
-	memcpy(data.ptrw(), p_buffer, p_buffer_size);
+void LaggyMultiplayerPeer::send_packet(LaggyPacketData &&p_data, Peer p_peer, double p_time) {
 	LaggyPacket packet = {
-		data,
+		std::move(p_data),
 		transfer_mode,
 		0,
 		transfer_channel,
-		target_peer,
-		get_time() + delay,
+		p_peer,
+		p_time,
+		p_time,
 	};
 
-	LaggyPacketChannel &channel = send_channels[target_peer][transfer_channel];
-	channel.generate_sequence(packet);
-
-	if (drop_packet) {
-		if (transfer_mode == TRANSFER_MODE_RELIABLE) {
-			retry_send_packets.push_back(packet);
+	if (delivery_thread.is_null()) {
+		// Otherwise sequenced by the delivery thread, which owns the send channels.
+		LaggyPacketChannel &channel = send_channels.get_channel(p_peer, transfer_channel);
+		if (!admit(send_channels, channel, packet)) {
+			return;
 		}
+		channel.generate_sequence(packet);
+		channel.count_queued(packet);
+	}
+
+	double delay = 0.0;
+	bool drop_packet = false;
+	if (sample_rule(true, packet, *rng.ptr(), delay, drop_packet)) {
+		// Rules take over from the handler for the packets they match.
+	} else if (use_batch_handlers && handle_send.is_valid()) {
+		// The delay is decided by the batch handler on the next poll, counting from now.
+		batched_send_packets.push_back(packet);
+		return;
+	} else if (handle_send.is_valid()) {
+		call_handler(handle_send, "handle_send", p_peer, transfer_mode, transfer_channel, packet.data.size(), delay, drop_packet);
+	} else {
+		get_random_delay(send_channels, p_time, delay, drop_packet);
+	}
+
+	dispatch(std::move(packet), delay, drop_packet, retry_send_packets, send_channels);
+}
+
+Error LaggyMultiplayerPeer::_put_packet(const uint8_t *p_buffer, int32_t p_buffer_size) {
+	ERR_FAIL_COND_V(wrapped_peer.is_null(), ERR_UNCONFIGURED);
+	LaggyPollProfiler::Scope profile_scope(poll_profiler, POLL_PHASE_PUT_PACKET);
+	if (!can_send(p_buffer_size)) {
+		return ERR_BUSY;
+	}
+
+	LaggyPacketData data = packet_pool.copy(p_buffer, p_buffer_size);
+	ERR_FAIL_COND_V(data.is_null(), ERR_OUT_OF_MEMORY);
+	double time = get_time();
+
+	if (target_peer > 0) {
+		send_packet(std::move(data), target_peer, time);
 		return OK;
 	}
 
-	channel.push(packet);
+	// Broadcasts become one packet per peer, with their own delay and loss, which all share the same payload.
+	// A negative target excludes that peer, and TARGET_PEER_BROADCAST (0) never matches one.
+	for (Peer peer : connected_peers) {
+		if (peer != -target_peer) {
+			send_packet(LaggyPacketData(data), peer, time);
+		}
+	}
 	return OK;
 }
 
 int32_t LaggyMultiplayerPeer::_get_packet_channel() const {
-	ERR_FAIL_COND_V(available_packets.size() == 0, 0);
-	return available_packets[0].channel;
+	ERR_FAIL_COND_V(_get_available_packet_count() == 0, 0);
+	return available_packets[get_next_packet_index()].channel;
 }
 
 MultiplayerPeer::TransferMode LaggyMultiplayerPeer::_get_packet_mode() const {
-	ERR_FAIL_COND_V(available_packets.size() == 0, TransferMode::TRANSFER_MODE_RELIABLE);
-	return available_packets[0].mode;
+	ERR_FAIL_COND_V(_get_available_packet_count() == 0, TransferMode::TRANSFER_MODE_RELIABLE);
+	return available_packets[get_next_packet_index()].mode;
 }
 
 int32_t LaggyMultiplayerPeer::_get_packet_peer() const {
-	ERR_FAIL_COND_V(available_packets.size() == 0, 0);
-	return available_packets[0].peer;
+	ERR_FAIL_COND_V(_get_available_packet_count() == 0, 0);
+	return available_packets[get_next_packet_index()].peer;
 }
 
 bool LaggyMultiplayerPeer::_is_server() const {
 	ERR_FAIL_COND_V(wrapped_peer.is_null(), true);
-	return wrapped_peer->get_unique_id() == TARGET_PEER_SERVER;
+	return _get_unique_id() == TARGET_PEER_SERVER;
 }
 
 void LaggyMultiplayerPeer::_poll() {
 	ERR_FAIL_COND(wrapped_peer.is_null());
-	wrapped_peer->poll();
+	// Each sample covers a poll and the packets put until the next one.
+	poll_profiler.finish_sample();
+	// The only phase that includes the others.
+	LaggyPollProfiler::Scope total_scope(poll_profiler, POLL_PHASE_TOTAL, false);
+
+	if (delivery_thread.is_valid()) {
+		// The delivery thread polls the wrapped peer, and reports what it received.
+		LaggyPollProfiler::Scope profile_scope(poll_profiler, POLL_PHASE_RECEIVE);
+		handle_delivery_events();
+	} else {
+		LaggyPollProfiler::Scope profile_scope(poll_profiler, POLL_PHASE_WRAPPED_POLL);
+		wrapped_peer->poll();
+	}
 	if (get_connection_status() != CONNECTION_CONNECTED) {
 		return;
 	}
 
 	double current_time = get_time();
 
-	// Send packets
-	process_packets(send_channels, current_time, [&](const LaggyPacket &packet) {
-		wrapped_peer->set_target_peer(packet.peer);
-		wrapped_peer->set_transfer_mode(packet.mode);
-		wrapped_peer->set_transfer_channel(packet.channel);
+	// Brings the bandwidth of profiles and the scenario up to date, or back to the user's once they no longer set one
+	advance_conditions(send_channels, current_time);
+	advance_conditions(receive_channels, current_time);
 
-		Error err = wrapped_peer->put_packet(packet.data);
-		ERR_FAIL_COND_MSG(err != OK, vformat("wrapped_peer->put_packet(packet.data) returned error: %s", UtilityFunctions::error_string(err)));
-	});
+	// Decide the delays of packets sent since the last poll
+	call_batch_handler(handle_send, "handle_send", send_batch, batched_send_packets, retry_send_packets, send_channels);
 
-	// Receive packets
-	while (wrapped_peer->get_available_packet_count() > 0) {
-		TransferMode packet_mode = wrapped_peer->get_packet_mode();
-		int32_t packet_channel = wrapped_peer->get_packet_channel();
-		int32_t packet_sender = wrapped_peer->get_packet_peer();
+	// Switched here, when no sent packets are waiting for the batch handler
+	if (use_delivery_thread && delivery_thread.is_null()) {
+		start_delivery_thread();
+	} else if (!use_delivery_thread && delivery_thread.is_valid()) {
+		stop_delivery_thread(true);
+	}
 
-		PackedByteArray data = wrapped_peer->get_packet();
-		Error err = wrapped_peer->get_packet_error();
-		ERR_CONTINUE_MSG(err != OK, vformat("wrapped_peer->get_packet_error() returned error: %s", UtilityFunctions::error_string(err)));
+	// Retries and due packets of each peer are processed on the WorkerThreadPool when possible
+	bool send_in_parallel = can_process_in_parallel(true);
+	bool receive_in_parallel = can_process_in_parallel(false);
 
-		double delay = 0.0;
-		bool drop_packet = false;
-		if (handle_receive.is_valid()) {
-			call_handler(handle_receive, "handle_receive", packet_sender, packet_mode, packet_channel, data.size(), delay, drop_packet);
-		} else {
-			get_random_delay(delay, drop_packet);
-		}
-
-		LaggyPacket packet = {
-			data,
-			packet_mode,
-			0,
-			packet_channel,
-			packet_sender,
-			current_time + delay,
-		};
-		LaggyPacketChannel &channel = receive_channels[packet_sender][packet_channel];
-		channel.generate_sequence(packet);
+	if (delivery_thread.is_valid()) {
+		LaggyPollProfiler::Scope profile_scope(poll_profiler, POLL_PHASE_SEND);
+		flush_overflow_requests();
+		// Keeps the getters of the send side no more than a poll behind.
+		delivery_snapshot_requested.store(true, std::memory_order_release);
+	} else {
+		// Send packets
+		{
+			LaggyPollProfiler::Scope profile_scope(poll_profiler, POLL_PHASE_SEND);
+			if (send_in_parallel) {
+				process_in_parallel(true, current_time);
+			} else {
+				send_due(current_time);
+			}
+		}
 
-		if (drop_packet) {
-			if (packet_mode == TRANSFER_MODE_RELIABLE) {
-				retry_receive_packets.push_back(packet);
+		// Receive packets
+		LaggyPollProfiler::Scope profile_scope(poll_profiler, POLL_PHASE_RECEIVE);
+		LaggyPacket packet;
+		// The count is only asked for again once the packets it reported have been read.
+		int32_t available = get_wrapped_packet_count();
+		while (available > 0) {
+			Peer sender = get_wrapped_packet_peer();
+			if (settings.queue_overflow_policy == QUEUE_OVERFLOW_BACKPRESSURE && settings.queue_limits.is_limited() && !has_room(receive_channels, sender, 0, 0)) {
+				// Left in the wrapped peer until there is room, like an application that stops reading its socket.
+				break;
+			}
+			if (read_wrapped_packet(current_time, sender, packet)) {
+				receive_packet(std::move(packet));
+			}
+			if (--available == 0) {
+				available = get_wrapped_packet_count();
 			}
-		} else {
-			channel.push(packet);
 		}
 	}
 
 	// Retry dropped packets
-	retry(retry_send_packets, handle_send, "handle_send", current_time, send_channels);
-	retry(retry_receive_packets, handle_receive, "handle_receive", current_time, receive_channels);
+	if (!send_in_parallel) {
+		LaggyPollProfiler::Scope profile_scope(poll_profiler, POLL_PHASE_RETRY);
+		retry(retry_send_packets, handle_send, "handle_send", batched_send_packets, current_time, send_channels);
+	}
+	if (!receive_in_parallel) {
+		LaggyPollProfiler::Scope profile_scope(poll_profiler, POLL_PHASE_RETRY);
+		retry(retry_receive_packets, handle_receive, "handle_receive", batched_receive_packets, current_time, receive_channels);
+	}
+
+	// Decide the delays of received packets, once for the whole poll
+	call_batch_handler(handle_receive, "handle_receive", receive_batch, batched_receive_packets, retry_receive_packets, receive_channels);
 
 	// Enqueue available packets
-	process_packets(receive_channels, current_time, [&](const LaggyPacket &packet) {
-		available_packets.push_back(packet);
-	});
+	if (receive_in_parallel) {
+		LaggyPollProfiler::Scope profile_scope(poll_profiler, POLL_PHASE_AVAILABLE);
+		process_in_parallel(false, current_time);
+	} else {
+		LaggyPollProfiler::Scope profile_scope(poll_profiler, POLL_PHASE_AVAILABLE);
+		receive_channels.take_due(current_time, [&](LaggyPacket &packet) {
+			available_bytes += packet.data.size();
+			available_packets.push_back(std::move(packet));
+		});
+	}
+
+	if (delivery_thread.is_null()) {
+		// Poll again, in case the peer only sends packets to the network during poll()
+		LaggyPollProfiler::Scope profile_scope(poll_profiler, POLL_PHASE_WRAPPED_POLL);
+		wrapped_peer->poll();
+	}
 
-	// Poll again, in case the peer only sends packets to the network during poll()
-	wrapped_peer->poll();
 }
 
 void LaggyMultiplayerPeer::_close() {
 	ERR_FAIL_COND(wrapped_peer.is_null());
+	// Restarted by the next poll once the wrapped peer is connected again, if it is still enabled.
+	stop_delivery_thread(true);
 	wrapped_peer->close();
 }
 
 void LaggyMultiplayerPeer::_disconnect_peer(int32_t p_peer, bool p_force) {
 	ERR_FAIL_COND(wrapped_peer.is_null());
+	if (delivery_thread.is_valid()) {
+		submit_delivery_request({ DeliveryRequest::DISCONNECT_PEER, LaggyPacket(), 0.0, p_force, uint64_t(p_peer) });
+		return;
+	}
 	wrapped_peer->disconnect_peer(p_peer, p_force);
 }
 
 int32_t LaggyMultiplayerPeer::_get_unique_id() const {
 	ERR_FAIL_COND_V(wrapped_peer.is_null(), 0);
+	if (delivery_thread.is_valid()) {
+		return delivery_unique_id.load(std::memory_order_acquire);
+	}
 	return wrapped_peer->get_unique_id();
 }
 
 void LaggyMultiplayerPeer::_set_refuse_new_connections(bool p_enable) {
 	ERR_FAIL_COND(wrapped_peer.is_null());
+	if (delivery_thread.is_valid()) {
+		delivery_refusing_new_connections.store(p_enable, std::memory_order_relaxed);
+		submit_delivery_request({ DeliveryRequest::SET_REFUSE_NEW_CONNECTIONS, LaggyPacket(), 0.0, p_enable, 0 });
+		return;
+	}
 	wrapped_peer->set_refuse_new_connections(p_enable);
 }
 
 bool LaggyMultiplayerPeer::_is_refusing_new_connections() const {
+	if (delivery_thread.is_valid()) {
+		return delivery_refusing_new_connections.load(std::memory_order_relaxed);
+	}
 	return wrapped_peer.is_valid() && wrapped_peer->is_refusing_new_connections();
 }
 
 bool LaggyMultiplayerPeer::_is_server_relay_supported() const {
 	ERR_FAIL_COND_V(wrapped_peer.is_null(), false);
+	if (delivery_thread.is_valid()) {
+		return delivery_server_relay_supported;
+	}
 	return wrapped_peer->is_server_relay_supported();
 }
 
 MultiplayerPeer::ConnectionStatus LaggyMultiplayerPeer::_get_connection_status() const {
 	ERR_FAIL_COND_V(wrapped_peer.is_null(), ConnectionStatus::CONNECTION_DISCONNECTED);
+	if (delivery_thread.is_valid()) {
+		// Published by the delivery thread after each time it polls the wrapped peer.
+		return delivery_connection_status.load(std::memory_order_acquire);
+	}
 	return wrapped_peer->get_connection_status();
 }
 
@@ -311,6 +1711,7 @@ void LaggyMultiplayerPeer::_bind_methods() {
 	ClassDB::bind_static_method("LaggyMultiplayerPeer", D_METHOD("create", "wrapped_peer", "delay_minimum", "delay_maximum", "packet_loss"), &LaggyMultiplayerPeer::create, DEFVAL(0.0), DEFVAL(0.0), DEFVAL(0.0));
 
 	ClassDB::bind_method(D_METHOD("drop_packet"), &LaggyMultiplayerPeer::drop_packet);
+	ClassDB::bind_method(D_METHOD("get_next_delivery_time"), &LaggyMultiplayerPeer::get_next_delivery_time);
 
 	ClassDB::bind_method(D_METHOD("set_wrapped_peer", "peer"), &LaggyMultiplayerPeer::set_wrapped_peer);
 	ClassDB::bind_method(D_METHOD("get_wrapped_peer"), &LaggyMultiplayerPeer::get_wrapped_peer);
@@ -318,17 +1719,153 @@ void LaggyMultiplayerPeer::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("get_handle_send"), &LaggyMultiplayerPeer::get_handle_send);
 	ClassDB::bind_method(D_METHOD("set_handle_receive", "callback"), &LaggyMultiplayerPeer::set_handle_receive);
 	ClassDB::bind_method(D_METHOD("get_handle_receive"), &LaggyMultiplayerPeer::get_handle_receive);
+	ClassDB::bind_method(D_METHOD("set_use_batch_handlers", "enabled"), &LaggyMultiplayerPeer::set_use_batch_handlers);
+	ClassDB::bind_method(D_METHOD("is_using_batch_handlers"), &LaggyMultiplayerPeer::is_using_batch_handlers);
+	ClassDB::bind_method(D_METHOD("load_profile", "path", "send"), &LaggyMultiplayerPeer::load_profile, DEFVAL(true));
+	ClassDB::bind_method(D_METHOD("clear_profile", "send"), &LaggyMultiplayerPeer::clear_profile, DEFVAL(true));
+	ClassDB::bind_method(D_METHOD("has_profile", "send"), &LaggyMultiplayerPeer::has_profile, DEFVAL(true));
+	ClassDB::bind_method(D_METHOD("start_recording", "path", "include_payload"), &LaggyMultiplayerPeer::start_recording, DEFVAL(false));
+	ClassDB::bind_method(D_METHOD("stop_recording"), &LaggyMultiplayerPeer::stop_recording);
+	ClassDB::bind_method(D_METHOD("is_recording"), &LaggyMultiplayerPeer::is_recording);
+	ClassDB::bind_method(D_METHOD("start_replay", "path"), &LaggyMultiplayerPeer::start_replay);
+	ClassDB::bind_method(D_METHOD("stop_replay"), &LaggyMultiplayerPeer::stop_replay);
+	ClassDB::bind_method(D_METHOD("is_replaying"), &LaggyMultiplayerPeer::is_replaying);
+	ClassDB::bind_method(D_METHOD("set_use_delivery_thread", "enabled"), &LaggyMultiplayerPeer::set_use_delivery_thread);
+	ClassDB::bind_method(D_METHOD("set_use_worker_threads", "enabled"), &LaggyMultiplayerPeer::set_use_worker_threads);
+	ClassDB::bind_method(D_METHOD("is_using_worker_threads"), &LaggyMultiplayerPeer::is_using_worker_threads);
+	ClassDB::bind_method(D_METHOD("set_use_poll_profiler", "enabled"), &LaggyMultiplayerPeer::set_use_poll_profiler);
+	ClassDB::bind_method(D_METHOD("is_using_poll_profiler"), &LaggyMultiplayerPeer::is_using_poll_profiler);
+	ClassDB::bind_method(D_METHOD("get_poll_samples"), &LaggyMultiplayerPeer::get_poll_samples);
+	ClassDB::bind_method(D_METHOD("get_poll_phase_percentile", "phase", "percentile"), &LaggyMultiplayerPeer::get_poll_phase_percentile);
+	ClassDB::bind_method(D_METHOD("save_poll_trace", "path"), &LaggyMultiplayerPeer::save_poll_trace);
+	ClassDB::bind_method(D_METHOD("clear_poll_samples"), &LaggyMultiplayerPeer::clear_poll_samples);
+	ClassDB::bind_method(D_METHOD("is_using_delivery_thread"), &LaggyMultiplayerPeer::is_using_delivery_thread);
 	ClassDB::bind_method(D_METHOD("set_delay_minimum", "value"), &LaggyMultiplayerPeer::set_delay_minimum);
 	ClassDB::bind_method(D_METHOD("get_delay_minimum"), &LaggyMultiplayerPeer::get_delay_minimum);
 	ClassDB::bind_method(D_METHOD("set_delay_maximum", "value"), &LaggyMultiplayerPeer::set_delay_maximum);
 	ClassDB::bind_method(D_METHOD("get_delay_maximum"), &LaggyMultiplayerPeer::get_delay_maximum);
 	ClassDB::bind_method(D_METHOD("set_packet_loss", "loss"), &LaggyMultiplayerPeer::set_packet_loss);
 	ClassDB::bind_method(D_METHOD("get_packet_loss"), &LaggyMultiplayerPeer::get_packet_loss);
+	ClassDB::bind_method(D_METHOD("set_packet_duplication", "probability"), &LaggyMultiplayerPeer::set_packet_duplication);
+	ClassDB::bind_method(D_METHOD("get_packet_duplication"), &LaggyMultiplayerPeer::get_packet_duplication);
+	ClassDB::bind_method(D_METHOD("set_packet_reordering", "probability"), &LaggyMultiplayerPeer::set_packet_reordering);
+	ClassDB::bind_method(D_METHOD("get_packet_reordering"), &LaggyMultiplayerPeer::get_packet_reordering);
+	ClassDB::bind_method(D_METHOD("set_packet_corruption", "probability"), &LaggyMultiplayerPeer::set_packet_corruption);
+	ClassDB::bind_method(D_METHOD("get_packet_corruption"), &LaggyMultiplayerPeer::get_packet_corruption);
+	ClassDB::bind_method(D_METHOD("set_corruption_bit_rate", "rate"), &LaggyMultiplayerPeer::set_corruption_bit_rate);
+	ClassDB::bind_method(D_METHOD("get_corruption_bit_rate"), &LaggyMultiplayerPeer::get_corruption_bit_rate);
+	ClassDB::bind_method(D_METHOD("set_retry_timeout", "value"), &LaggyMultiplayerPeer::set_retry_timeout);
+	ClassDB::bind_method(D_METHOD("get_retry_timeout"), &LaggyMultiplayerPeer::get_retry_timeout);
+	ClassDB::bind_method(D_METHOD("set_retry_backoff", "value"), &LaggyMultiplayerPeer::set_retry_backoff);
+	ClassDB::bind_method(D_METHOD("get_retry_backoff"), &LaggyMultiplayerPeer::get_retry_backoff);
+	ClassDB::bind_method(D_METHOD("set_retry_timeout_maximum", "value"), &LaggyMultiplayerPeer::set_retry_timeout_maximum);
+	ClassDB::bind_method(D_METHOD("get_retry_timeout_maximum"), &LaggyMultiplayerPeer::get_retry_timeout_maximum);
+	ClassDB::bind_method(D_METHOD("set_clock_mode", "mode"), &LaggyMultiplayerPeer::set_clock_mode);
+	ClassDB::bind_method(D_METHOD("get_clock_mode"), &LaggyMultiplayerPeer::get_clock_mode);
+	ClassDB::bind_method(D_METHOD("advance_time", "seconds"), &LaggyMultiplayerPeer::advance_time);
+	ClassDB::bind_method(D_METHOD("get_time"), &LaggyMultiplayerPeer::get_time);
+	ClassDB::bind_method(D_METHOD("set_seed", "seed"), &LaggyMultiplayerPeer::set_seed);
+	ClassDB::bind_method(D_METHOD("get_seed"), &LaggyMultiplayerPeer::get_seed);
+
+	ClassDB::bind_method(D_METHOD("get_stats"), &LaggyMultiplayerPeer::get_stats);
+	ClassDB::bind_method(D_METHOD("reset_stats"), &LaggyMultiplayerPeer::reset_stats);
+	ClassDB::bind_method(D_METHOD("get_delay_percentile", "percentile", "send"), &LaggyMultiplayerPeer::get_delay_percentile, DEFVAL(true));
+	ClassDB::bind_method(D_METHOD("get_residence_percentile", "percentile", "send"), &LaggyMultiplayerPeer::get_residence_percentile, DEFVAL(true));
+	ClassDB::bind_method(D_METHOD("set_monitor_category", "category"), &LaggyMultiplayerPeer::set_monitor_category);
+	ClassDB::bind_method(D_METHOD("get_monitor_category"), &LaggyMultiplayerPeer::get_monitor_category);
+	ClassDB::bind_method(D_METHOD("set_send_bandwidth", "bytes_per_second"), &LaggyMultiplayerPeer::set_send_bandwidth);
+	ClassDB::bind_method(D_METHOD("get_send_bandwidth"), &LaggyMultiplayerPeer::get_send_bandwidth);
+	ClassDB::bind_method(D_METHOD("set_receive_bandwidth", "bytes_per_second"), &LaggyMultiplayerPeer::set_receive_bandwidth);
+	ClassDB::bind_method(D_METHOD("get_receive_bandwidth"), &LaggyMultiplayerPeer::get_receive_bandwidth);
+	ClassDB::bind_method(D_METHOD("set_link_burst", "bytes"), &LaggyMultiplayerPeer::set_link_burst);
+	ClassDB::bind_method(D_METHOD("get_link_burst"), &LaggyMultiplayerPeer::get_link_burst);
+	ClassDB::bind_method(D_METHOD("set_link_queue_size", "bytes"), &LaggyMultiplayerPeer::set_link_queue_size);
+	ClassDB::bind_method(D_METHOD("get_link_queue_size"), &LaggyMultiplayerPeer::get_link_queue_size);
+	ClassDB::bind_method(D_METHOD("set_link_queue_policy", "policy"), &LaggyMultiplayerPeer::set_link_queue_policy);
+	ClassDB::bind_method(D_METHOD("get_link_queue_policy"), &LaggyMultiplayerPeer::get_link_queue_policy);
+	ClassDB::bind_method(D_METHOD("set_link_mtu", "bytes"), &LaggyMultiplayerPeer::set_link_mtu);
+	ClassDB::bind_method(D_METHOD("get_link_mtu"), &LaggyMultiplayerPeer::get_link_mtu);
+	ClassDB::bind_method(D_METHOD("set_link_overhead", "bytes"), &LaggyMultiplayerPeer::set_link_overhead);
+	ClassDB::bind_method(D_METHOD("get_link_overhead"), &LaggyMultiplayerPeer::get_link_overhead);
+	ClassDB::bind_method(D_METHOD("get_link_backlog", "peer", "send"), &LaggyMultiplayerPeer::get_link_backlog, DEFVAL(true));
+	ClassDB::bind_method(D_METHOD("set_max_queued_packets", "packets"), &LaggyMultiplayerPeer::set_max_queued_packets);
+	ClassDB::bind_method(D_METHOD("get_max_queued_packets"), &LaggyMultiplayerPeer::get_max_queued_packets);
+	ClassDB::bind_method(D_METHOD("set_max_queued_bytes", "bytes"), &LaggyMultiplayerPeer::set_max_queued_bytes);
+	ClassDB::bind_method(D_METHOD("get_max_queued_bytes"), &LaggyMultiplayerPeer::get_max_queued_bytes);
+	ClassDB::bind_method(D_METHOD("set_max_queued_packets_per_peer", "packets"), &LaggyMultiplayerPeer::set_max_queued_packets_per_peer);
+	ClassDB::bind_method(D_METHOD("get_max_queued_packets_per_peer"), &LaggyMultiplayerPeer::get_max_queued_packets_per_peer);
+	ClassDB::bind_method(D_METHOD("set_max_queued_bytes_per_peer", "bytes"), &LaggyMultiplayerPeer::set_max_queued_bytes_per_peer);
+	ClassDB::bind_method(D_METHOD("get_max_queued_bytes_per_peer"), &LaggyMultiplayerPeer::get_max_queued_bytes_per_peer);
+	ClassDB::bind_method(D_METHOD("set_queue_overflow_policy", "policy"), &LaggyMultiplayerPeer::set_queue_overflow_policy);
+	ClassDB::bind_method(D_METHOD("get_queue_overflow_policy"), &LaggyMultiplayerPeer::get_queue_overflow_policy);
+	ClassDB::bind_method(D_METHOD("get_memory_usage"), &LaggyMultiplayerPeer::get_memory_usage);
+	ClassDB::bind_method(D_METHOD("set_impairment", "impairment"), &LaggyMultiplayerPeer::set_impairment);
+	ClassDB::bind_method(D_METHOD("get_impairment"), &LaggyMultiplayerPeer::get_impairment);
+	ClassDB::bind_method(D_METHOD("set_rule_set", "rule_set"), &LaggyMultiplayerPeer::set_rule_set);
+	ClassDB::bind_method(D_METHOD("get_rule_set"), &LaggyMultiplayerPeer::get_rule_set);
+	ClassDB::bind_method(D_METHOD("set_scenario", "scenario"), &LaggyMultiplayerPeer::set_scenario);
+	ClassDB::bind_method(D_METHOD("get_scenario"), &LaggyMultiplayerPeer::get_scenario);
+	ClassDB::bind_method(D_METHOD("restart_scenario"), &LaggyMultiplayerPeer::restart_scenario);
+	ClassDB::bind_method(D_METHOD("get_scenario_time"), &LaggyMultiplayerPeer::get_scenario_time);
 
 	ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "wrapped_peer", PROPERTY_HINT_RESOURCE_TYPE, "MultiplayerPeer"), "set_wrapped_peer", "get_wrapped_peer");
 	ADD_PROPERTY(PropertyInfo(Variant::CALLABLE, "handle_send"), "set_handle_send", "get_handle_send");
 	ADD_PROPERTY(PropertyInfo(Variant::CALLABLE, "handle_receive"), "set_handle_receive", "get_handle_receive");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "use_batch_handlers"), "set_use_batch_handlers", "is_using_batch_handlers");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "use_delivery_thread"), "set_use_delivery_thread", "is_using_delivery_thread");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "use_worker_threads"), "set_use_worker_threads", "is_using_worker_threads");
 	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "delay_minimum"), "set_delay_minimum", "get_delay_minimum");
 	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "delay_maximum"), "set_delay_maximum", "get_delay_maximum");
 	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "packet_loss"), "set_packet_loss", "get_packet_loss");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "packet_duplication", PROPERTY_HINT_RANGE, "0,1,0.001"), "set_packet_duplication", "get_packet_duplication");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "packet_reordering", PROPERTY_HINT_RANGE, "0,1,0.001"), "set_packet_reordering", "get_packet_reordering");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "packet_corruption", PROPERTY_HINT_RANGE, "0,1,0.001"), "set_packet_corruption", "get_packet_corruption");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "corruption_bit_rate", PROPERTY_HINT_RANGE, "0,0.5,0.0001"), "set_corruption_bit_rate", "get_corruption_bit_rate");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "retry_timeout"), "set_retry_timeout", "get_retry_timeout");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "retry_backoff"), "set_retry_backoff", "get_retry_backoff");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "retry_timeout_maximum"), "set_retry_timeout_maximum", "get_retry_timeout_maximum");
+	ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "impairment", PROPERTY_HINT_RESOURCE_TYPE, "LaggyImpairment"), "set_impairment", "get_impairment");
+	ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "rule_set", PROPERTY_HINT_RESOURCE_TYPE, "LaggyRuleSet"), "set_rule_set", "get_rule_set");
+	ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "scenario", PROPERTY_HINT_RESOURCE_TYPE, "LaggyScenario"), "set_scenario", "get_scenario");
+
+	ADD_PROPERTY(PropertyInfo(Variant::STRING, "monitor_category"), "set_monitor_category", "get_monitor_category");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "use_poll_profiler"), "set_use_poll_profiler", "is_using_poll_profiler");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "clock_mode", PROPERTY_HINT_ENUM, "Real Time,Manual"), "set_clock_mode", "get_clock_mode");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "seed"), "set_seed", "get_seed");
+
+	ADD_GROUP("Link", "");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "send_bandwidth", PROPERTY_HINT_RANGE, "0,1000000,1,or_greater,suffix:B/s"), "set_send_bandwidth", "get_send_bandwidth");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "receive_bandwidth", PROPERTY_HINT_RANGE, "0,1000000,1,or_greater,suffix:B/s"), "set_receive_bandwidth", "get_receive_bandwidth");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "link_burst", PROPERTY_HINT_RANGE, "0,65536,1,or_greater,suffix:B"), "set_link_burst", "get_link_burst");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "link_queue_size", PROPERTY_HINT_RANGE, "0,1048576,1,or_greater,suffix:B"), "set_link_queue_size", "get_link_queue_size");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "link_queue_policy", PROPERTY_HINT_ENUM, "Drop Tail,Random Early Detection"), "set_link_queue_policy", "get_link_queue_policy");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "link_mtu", PROPERTY_HINT_RANGE, "0,65536,1,or_greater,suffix:B"), "set_link_mtu", "get_link_mtu");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "link_overhead", PROPERTY_HINT_RANGE, "0,128,1,or_greater,suffix:B"), "set_link_overhead", "get_link_overhead");
+
+	ADD_GROUP("Queue Limits", "");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "max_queued_packets", PROPERTY_HINT_RANGE, "0,100000,1,or_greater"), "set_max_queued_packets", "get_max_queued_packets");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "max_queued_bytes", PROPERTY_HINT_RANGE, "0,104857600,1,or_greater,suffix:B"), "set_max_queued_bytes", "get_max_queued_bytes");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "max_queued_packets_per_peer", PROPERTY_HINT_RANGE, "0,100000,1,or_greater"), "set_max_queued_packets_per_peer", "get_max_queued_packets_per_peer");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "max_queued_bytes_per_peer", PROPERTY_HINT_RANGE, "0,104857600,1,or_greater,suffix:B"), "set_max_queued_bytes_per_peer", "get_max_queued_bytes_per_peer");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "queue_overflow_policy", PROPERTY_HINT_ENUM, "Drop Tail,Drop Oldest Unreliable,Backpressure"), "set_queue_overflow_policy", "get_queue_overflow_policy");
+
+	BIND_ENUM_CONSTANT(CLOCK_REAL_TIME);
+	BIND_ENUM_CONSTANT(CLOCK_MANUAL);
+
+	BIND_ENUM_CONSTANT(LINK_QUEUE_DROP_TAIL);
+	BIND_ENUM_CONSTANT(LINK_QUEUE_RED);
+
+	BIND_ENUM_CONSTANT(QUEUE_OVERFLOW_DROP_TAIL);
+	BIND_ENUM_CONSTANT(QUEUE_OVERFLOW_DROP_OLDEST_UNRELIABLE);
+	BIND_ENUM_CONSTANT(QUEUE_OVERFLOW_BACKPRESSURE);
+
+	BIND_ENUM_CONSTANT(POLL_PHASE_TOTAL);
+	BIND_ENUM_CONSTANT(POLL_PHASE_WRAPPED_POLL);
+	BIND_ENUM_CONSTANT(POLL_PHASE_SEND);
+	BIND_ENUM_CONSTANT(POLL_PHASE_RECEIVE);
+	BIND_ENUM_CONSTANT(POLL_PHASE_RETRY);
+	BIND_ENUM_CONSTANT(POLL_PHASE_HANDLERS);
+	BIND_ENUM_CONSTANT(POLL_PHASE_AVAILABLE);
+	BIND_ENUM_CONSTANT(POLL_PHASE_PUT_PACKET);
+	BIND_ENUM_CONSTANT(POLL_PHASE_MAX);
 }
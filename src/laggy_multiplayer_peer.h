@@ -1,12 +1,27 @@
 #ifndef LAGGY_MULTIPLAYER_PEER_GDEXTENSION_H
 #define LAGGY_MULTIPLAYER_PEER_GDEXTENSION_H
 
+#include "laggy_corruption.h"
+#include "laggy_impairment.h"
 #include "laggy_packet.h"
+#include "laggy_packet_batch.h"
+#include "laggy_poll_profiler.h"
+#include "laggy_profile_trace.h"
+#include "laggy_rule_set.h"
+#include "laggy_scenario.h"
+#include "laggy_trace.h"
+#include "mpsc_queue.h"
+#include "ring_queue.h"
+#include "spsc_queue.h"
 
 #include <godot_cpp/classes/multiplayer_peer_extension.hpp>
+#include <godot_cpp/classes/mutex.hpp>
 #include <godot_cpp/classes/random_number_generator.hpp>
+#include <godot_cpp/classes/thread.hpp>
 #include <godot_cpp/templates/hash_map.hpp>
 
+#include <atomic>
+
 using namespace godot;
 
 class LaggyMultiplayerPeer : public MultiplayerPeerExtension {
@@ -16,8 +31,33 @@ protected:
 	static void _bind_methods();
 
 public:
-	typedef HashMap<LaggyPacket::Channel, LaggyPacketChannel> ChannelMap;
-	typedef HashMap<LaggyPacket::Peer, ChannelMap> PeerChannelMap;
+	enum ClockMode {
+		CLOCK_REAL_TIME,
+		CLOCK_MANUAL,
+	};
+
+	enum LinkQueuePolicy {
+		LINK_QUEUE_DROP_TAIL,
+		LINK_QUEUE_RED,
+	};
+
+	enum QueueOverflowPolicy {
+		QUEUE_OVERFLOW_DROP_TAIL,
+		QUEUE_OVERFLOW_DROP_OLDEST_UNRELIABLE,
+		QUEUE_OVERFLOW_BACKPRESSURE,
+	};
+
+	enum PollPhase {
+		POLL_PHASE_TOTAL,
+		POLL_PHASE_WRAPPED_POLL,
+		POLL_PHASE_SEND,
+		POLL_PHASE_RECEIVE,
+		POLL_PHASE_RETRY,
+		POLL_PHASE_HANDLERS,
+		POLL_PHASE_AVAILABLE,
+		POLL_PHASE_PUT_PACKET,
+		POLL_PHASE_MAX,
+	};
 
 	typedef LaggyPacket::Sequence Sequence;
 	typedef LaggyPacket::Channel Channel;
@@ -25,42 +65,316 @@ public:
 
 private:
 	Ref<RandomNumberGenerator> rng = memnew(RandomNumberGenerator);
-	PeerChannelMap send_channels;
-	PeerChannelMap receive_channels;
-	Vector<LaggyPacket> available_packets;
-	Vector<LaggyPacket> retry_send_packets;
-	Vector<LaggyPacket> retry_receive_packets;
-	LaggyPacket current_packet = {};
+	ClockMode clock_mode = CLOCK_REAL_TIME;
+	// Current time when clock_mode is CLOCK_MANUAL, only moved by advance_time().
+	double manual_time = 0.0;
+	// Declared before every packet container, so it is destroyed after all of the packets holding its blocks.
+	LaggyPacketPool packet_pool;
+	// Reused for wrapped_peer->put_packet(), which only accepts a PackedByteArray.
+	PackedByteArray send_buffer;
+	LaggyChannelMap send_channels;
+	LaggyChannelMap receive_channels;
+	// The front packet stays in place while its buffer is handed out by _get_packet(), and is released on the next call.
+	RingQueue<LaggyPacket> available_packets;
+	uint64_t available_bytes = 0;
+	bool holding_current_packet = false;
+	// Settings read by whichever thread schedules packets. The delivery thread works with its own copy, handed over by
+	// update_delivery_settings(), so the setters never have to wait for it.
+	struct PipelineSettings {
+		// Applied to each direction separately. Packets waiting to be read count as received packets.
+		LaggyQueueLimits queue_limits;
+		QueueOverflowPolicy queue_overflow_policy = QUEUE_OVERFLOW_DROP_TAIL;
+		double retry_timeout = 0.0;
+		double retry_backoff = 1.0;
+		double retry_timeout_maximum = 0.0;
+		// Copied into send_channels, while receive_channels holds the settings of the receiving link.
+		LaggyLink::Settings send_link;
+	};
+	PipelineSettings settings;
+	// Set by the user, and applied to the links whenever neither a profile nor the scenario sets their bandwidth.
+	double send_bandwidth = 0.0;
+	double receive_bandwidth = 0.0;
+	// Dropped reliable packets, ordered by the time they will be retried.
+	LaggyPacketQueue retry_send_packets;
+	LaggyPacketQueue retry_receive_packets;
+	// Packets dropped again while retrying, held until the retry pass is done so they aren't retried twice in one poll.
+	LaggyPacketQueue dropped_retry_packets;
 
 	TransferMode transfer_mode = TRANSFER_MODE_RELIABLE;
 	Channel transfer_channel = 0;
 	Peer target_peer = 0;
 
 	Ref<MultiplayerPeer> wrapped_peer;
+	// The wrapped peer, when it's one of the peers of this extension, whose methods are called directly instead of through Godot.
+	MultiplayerPeerExtension *native_wrapped_peer = nullptr;
+	// Target the wrapped peer was last set to, so its setters are only called when it changes.
+	// Due packets come out one channel at a time, so consecutive packets usually share it.
+	struct WrappedTarget {
+		Peer peer = 0;
+		TransferMode mode = TRANSFER_MODE_RELIABLE;
+		Channel channel = 0;
+		bool valid = false;
+	} wrapped_target;
+	// Peers the wrapped peer reported as connected, in connection order, which broadcasts are sent to.
+	LocalVector<Peer> connected_peers;
 
 	Callable handle_send;
 	Callable handle_receive;
 	bool running_handler = false;
 	bool drop_requested = false;
 
+	// Packets waiting for the batch handlers, which are called once per poll.
+	bool use_batch_handlers = false;
+	Ref<LaggyPacketBatch> send_batch = memnew(LaggyPacketBatch);
+	Ref<LaggyPacketBatch> receive_batch = memnew(LaggyPacketBatch);
+	LocalVector<LaggyPacket> batched_send_packets;
+	LocalVector<LaggyPacket> batched_receive_packets;
+
 	double delay_minimum = 0.0;
 	double delay_maximum = 0.0;
 	double packet_loss = 0.0;
 
+	// Applied once to each packet, to the attempt that isn't dropped. Decided with their own random stream,
+	// so the decisions don't depend on how many numbers the delays took, which differs when replaying a trace.
+	Ref<RandomNumberGenerator> mutation_rng = memnew(RandomNumberGenerator);
+	double packet_duplication = 0.0;
+	double packet_reordering = 0.0;
+	double packet_corruption = 0.0;
+	double corruption_bit_rate = 0.0;
+	uint32_t corruption_rate_shift = 0;
+
+	Ref<LaggyImpairment> impairment;
+	LaggyImpairment::State send_impairment_state;
+	LaggyImpairment::State receive_impairment_state;
+	// Per-packet rules, which take priority over the handlers, a profile, a scenario and impairment for the packets they match.
+	Ref<LaggyRuleSet> rule_set;
+	// Measured link conditions, which take priority over impairment when loaded.
+	LaggyProfileTrace send_profile;
+	LaggyProfileTrace receive_profile;
+	// Scripted conditions over time, which take priority over impairment, but not over a profile.
+	Ref<LaggyScenario> scenario;
+	double scenario_start_time = 0.0;
+	LaggyScenario::Cursor scenario_cursor;
+	// Sampled by advance_conditions(), so sample_delay() only reads them.
+	LaggyScenario::Keyframe scenario_conditions;
+
+	enum Monitor {
+		MONITOR_QUEUED_PACKETS,
+		MONITOR_QUEUED_BYTES,
+		MONITOR_SENT_PACKETS,
+		MONITOR_RECEIVED_PACKETS,
+		MONITOR_DROPPED_PACKETS,
+		MONITOR_RETRIED_PACKETS,
+		MONITOR_SEND_DELAY_P99,
+		MONITOR_RECEIVE_DELAY_P99,
+		MONITOR_MAX,
+	};
+	static const char *monitor_names[MONITOR_MAX];
+	// Prefix of the custom monitors registered in Performance, or empty when they aren't registered.
+	String monitor_category;
+
+	// Sent packet whose delay was decided on the main thread, or an action on the wrapped peer, on its way to the delivery thread.
+	struct DeliveryRequest {
+		enum Type {
+			SEND_PACKET,
+			DISCONNECT_PEER,
+			SET_REFUSE_NEW_CONNECTIONS,
+			RESET_STATS,
+			SET_SEED,
+		};
+
+		Type type = SEND_PACKET;
+		LaggyPacket packet;
+		double delay = 0.0;
+		// Whether the packet is dropped, the peer is disconnected by force, or new connections are refused.
+		bool flag = false;
+		// Peer to disconnect, or the new seed.
+		uint64_t value = 0;
+	};
+
+	// Something that happened on the delivery thread, which the main thread has to act on.
+	struct DeliveryEvent {
+		enum Type {
+			PACKET_RECEIVED,
+			PACKET_DROPPED,
+			PEER_CONNECTED,
+			PEER_DISCONNECTED,
+		};
+
+		Type type = PACKET_RECEIVED;
+		LaggyPacket packet;
+		Peer peer = 0;
+	};
+
+	// Send side as the delivery thread last saw it, for the getters of the main thread, which can't read send_channels while it runs.
+	struct DeliverySnapshot {
+		struct PeerState {
+			LaggyLink link;
+			uint64_t queued_packets = 0;
+			uint64_t queued_bytes = 0;
+		};
+
+		struct ChannelState {
+			Peer peer = 0;
+			Channel channel = 0;
+			// Indexed by transfer mode.
+			LaggyTrafficCounters counters[3];
+		};
+
+		HashMap<Peer, PeerState> peers;
+		LocalVector<ChannelState> channels;
+		double next_time = Math_INF;
+		uint32_t deadline_count = 0;
+	};
+
+	static constexpr uint32_t DELIVERY_QUEUE_SIZE = 4096;
+	// Longest time the delivery thread sleeps without checking for new packets, in seconds.
+	static constexpr double DELIVERY_THREAD_MAX_WAIT = 0.001;
+
+	// While the delivery thread runs, it owns wrapped_peer and the send side: send_channels and delivery_retry_packets.
+	// The main thread never touches those, and only exchanges requests, events, settings and snapshots with it.
+	// delivery_mutex is only held for the exchange of settings and snapshots, never while packets are processed.
+	bool use_delivery_thread = false;
+	Ref<Thread> delivery_thread;
+	Ref<Mutex> delivery_mutex = memnew(Mutex);
+	std::atomic<bool> delivery_thread_exit = { false };
+	Ref<RandomNumberGenerator> delivery_rng = memnew(RandomNumberGenerator);
+	MPSCQueue<DeliveryRequest> delivery_requests;
+	SPSCQueue<DeliveryEvent> delivery_events;
+	// Requests that didn't fit in delivery_requests yet. Only used by the main thread.
+	LocalVector<DeliveryRequest> overflow_requests;
+	// Events that didn't fit in delivery_events yet. Only used by the delivery thread.
+	LocalVector<DeliveryEvent> overflow_events;
+	// Reliable packets dropped by the delivery thread, before they are handed to the main thread to be retried.
+	LaggyPacketQueue delivery_retry_packets;
+	// Copy of settings used by the delivery thread, and the one waiting for it, guarded by delivery_mutex.
+	PipelineSettings delivery_settings;
+	PipelineSettings pending_delivery_settings;
+	std::atomic<bool> delivery_settings_changed = { false };
+	// The published snapshot is only read with delivery_mutex held, while the delivery thread builds the other one.
+	DeliverySnapshot delivery_snapshots[2];
+	uint32_t published_snapshot = 0;
+	std::atomic<bool> delivery_snapshot_requested = { false };
+	// State of the wrapped peer, published by the delivery thread after each poll, or set by the main thread when it changes it.
+	std::atomic<ConnectionStatus> delivery_connection_status = { CONNECTION_DISCONNECTED };
+	std::atomic<int32_t> delivery_unique_id = { 0 };
+	std::atomic<bool> delivery_refusing_new_connections = { false };
+	bool delivery_server_relay_supported = false;
+
+	// Work of one peer in a pass on the WorkerThreadPool, along with the random state its retries are decided with,
+	// so results don't depend on how the peers are spread over threads. Indexed by the peer's slot in the channel map.
+	struct PeerTask {
+		Peer peer = 0;
+		Ref<RandomNumberGenerator> rng;
+		LaggyImpairment::State impairment_state;
+		// Due retries of the peer on the way in, and the ones that were dropped again on the way out.
+		LocalVector<LaggyPacket> retries;
+		// Delays of the retries that were scheduled, which are recorded once every task is done.
+		LocalVector<double> delays;
+		// Channels claimed from the deadline index, and the ones given retries, which are indexed again once every task is done.
+		LocalVector<Channel> channels;
+		LocalVector<LaggyPacket> due;
+		LocalVector<LaggyPacket> discarded;
+	};
+
+	static_assert(POLL_PHASE_MAX <= LaggyPollProfiler::MAX_PHASES);
+	static const char *poll_phase_names[POLL_PHASE_MAX];
+	LaggyPollProfiler poll_profiler;
+
+	bool use_worker_threads = false;
+	LocalVector<PeerTask> send_tasks;
+	LocalVector<PeerTask> receive_tasks;
+	// Direction and time of the pass running on the WorkerThreadPool.
+	bool parallel_send = false;
+	double parallel_time = 0.0;
+
+	LaggyTraceWriter trace_writer;
+	// Indexed by LaggyTraceRecord::Direction, since sent and received packets are replayed independently.
+	LaggyTraceReader replay_readers[2];
+	bool replay_diverged = false;
+
+	_FORCE_INLINE_ uint32_t get_next_packet_index() const { return holding_current_packet ? 1 : 0; }
+	void release_current_packet();
+
 	void on_peer_connected(Peer p_id);
 	void on_peer_disconnected(Peer p_id);
+	void add_peer(Peer p_id);
+	void remove_peer(Peer p_id);
 
-	void get_random_delay(double &out_delay, bool &out_drop_packet) const;
+	_FORCE_INLINE_ bool has_scenario() const { return scenario.is_valid() && scenario->get_keyframe_count() > 0; }
+	// Decides the delay of a packet with the rule set, before any handler is called. Returns false if no rule matches it.
+	_FORCE_INLINE_ bool sample_rule(bool p_send, const LaggyPacket &p_packet, RandomNumberGenerator &p_rng, double &out_delay, bool &out_drop_packet) const {
+		return rule_set.is_valid() && rule_set->sample(p_send, p_packet.peer, p_packet.channel, p_packet.mode, p_packet.data.size(), p_rng, out_delay, out_drop_packet);
+	}
+	void advance_conditions(LaggyChannelMap &p_channel_map, double p_time);
+	void apply_bandwidth(bool p_send, double p_override);
+	void sample_delay(bool p_send, RandomNumberGenerator &p_rng, LaggyImpairment::State &p_state, double &out_delay, bool &out_drop_packet) const;
+	void get_random_delay(LaggyChannelMap &p_channel_map, double p_time, double &out_delay, bool &out_drop_packet);
 	void call_handler(const Callable &p_handler, const char *p_handler_name, int32_t p_peer, TransferMode p_mode, int32_t p_channel, int32_t p_buffer_size, double &out_delay, bool &out_drop_packet);
-	void retry(Vector<LaggyPacket> &p_retry_packets, const Callable &p_custom_handler, const char *p_handler_name, double p_time, PeerChannelMap &p_channel_map);
+	void call_batch_handler(const Callable &p_handler, const char *p_handler_name, const Ref<LaggyPacketBatch> &p_batch, LocalVector<LaggyPacket> &p_packets, LaggyPacketQueue &p_retry_packets, LaggyChannelMap &p_channel_map);
+	// Settings of the thread that schedules the packets of p_channel_map.
+	_FORCE_INLINE_ const PipelineSettings &get_settings(const LaggyChannelMap &p_channel_map) const { return &p_channel_map == &send_channels && delivery_thread.is_valid() ? delivery_settings : settings; }
+	void update_delivery_settings();
+	static double get_retry_wait(const PipelineSettings &p_settings, double p_delay, uint32_t p_retries);
+	bool has_room(const LaggyChannelMap &p_channel_map, Peer p_peer, int32_t p_size, uint64_t p_extra_packets) const;
+	bool has_send_room(Peer p_peer, int32_t p_size, uint64_t p_extra_packets) const;
+	bool admit(LaggyChannelMap &p_channel_map, LaggyPacketChannel &p_channel, const LaggyPacket &p_packet);
+	bool can_send(int32_t p_size) const;
+	// Whether a packet of p_size bytes fits for every peer the current target sends to.
+	bool has_target_room(int32_t p_size) const;
+	void send_packet(LaggyPacketData &&p_data, Peer p_peer, double p_time);
+	void trace(const LaggyPacket &p_packet, LaggyTraceRecord::Direction p_direction, double &r_delay, bool &r_drop_packet);
+	void schedule(LaggyPacket &&p_packet, double p_delay, bool p_drop_packet, LaggyPacketQueue &p_retry_packets, LaggyChannelMap &p_channel_map, LaggyPacketChannel &p_channel, RandomNumberGenerator &p_rng);
+	_FORCE_INLINE_ bool has_mutations() const { return packet_duplication > 0.0 || packet_reordering > 0.0 || packet_corruption > 0.0; }
+	void corrupt(LaggyPacket &p_packet);
+	bool mutate(LaggyPacket &p_packet, double &r_delay, bool p_drop_packet, LaggyPacket &r_duplicate);
+	void schedule_duplicate(LaggyPacket &&p_packet, double p_delay, LaggyPacketQueue &p_retry_packets, LaggyChannelMap &p_channel_map, LaggyPacketChannel &p_channel);
+	void dispatch(LaggyPacket &&p_packet, double p_delay, bool p_drop_packet, LaggyPacketQueue &p_retry_packets, LaggyChannelMap &p_channel_map);
+	void put_wrapped_packet(const LaggyPacket &p_packet);
+	void send_due(double p_time);
+	_FORCE_INLINE_ int32_t get_wrapped_packet_count() const { return native_wrapped_peer ? native_wrapped_peer->_get_available_packet_count() : wrapped_peer->get_available_packet_count(); }
+	_FORCE_INLINE_ Peer get_wrapped_packet_peer() const { return native_wrapped_peer ? native_wrapped_peer->_get_packet_peer() : wrapped_peer->get_packet_peer(); }
+	bool read_wrapped_packet(double p_time, Peer p_sender, LaggyPacket &r_packet);
+	void receive_packet(LaggyPacket &&p_packet);
+	double get_monitor_value(int32_t p_monitor) const;
+	void update_monitors(const String &p_category);
+	void retry(LaggyPacketQueue &p_retry_packets, const Callable &p_custom_handler, const char *p_handler_name, LocalVector<LaggyPacket> &p_batched_packets, double p_time, LaggyChannelMap &p_channel_map);
+
+	void submit_delivery_request(DeliveryRequest &&p_request);
+	void flush_overflow_requests();
+	void process_delivery_request(DeliveryRequest &&p_request, RandomNumberGenerator &p_rng, LaggyPacketQueue &p_retry_packets);
+	void build_delivery_snapshot(DeliverySnapshot &r_snapshot);
+	void publish_delivery_snapshot();
+	void publish_delivery_status();
+	void post_delivery_event(DeliveryEvent &&p_event);
+	void flush_overflow_events();
+	void handle_delivery_event(DeliveryEvent &&p_event);
+	void handle_delivery_events();
+	void delivery_loop();
+	void start_delivery_thread();
+	void stop_delivery_thread(bool p_hand_over);
+
+	bool can_process_in_parallel(bool p_send) const;
+	void process_in_parallel(bool p_send, double p_time);
+	void process_peer_task(uint32_t p_slot);
+	static void process_peer_task_callback(void *p_userdata, uint32_t p_slot);
 
 public:
 	LaggyMultiplayerPeer() {}
-	~LaggyMultiplayerPeer() override {}
+	~LaggyMultiplayerPeer() override;
 
 	static Ref<LaggyMultiplayerPeer> create(const Ref<MultiplayerPeer> &p_wrapped_peer, double p_delay_minimum, double p_delay_maximum, double p_packet_loss);
 
 	void drop_packet();
+	double get_next_delivery_time();
+
+	void set_clock_mode(ClockMode p_mode);
+	ClockMode get_clock_mode() const { return clock_mode; }
+	void advance_time(double p_seconds);
+	double get_time() const;
+
+	void set_seed(uint64_t p_seed);
+	uint64_t get_seed() const { return rng->get_seed(); }
 
 	void set_wrapped_peer(const Ref<MultiplayerPeer> &p_peer);
 	Ref<MultiplayerPeer> get_wrapped_peer() const;
@@ -71,6 +385,33 @@ public:
 	void set_handle_receive(const Callable &p_callback) { handle_receive = p_callback; }
 	Callable get_handle_receive() const { return handle_receive; }
 
+	void set_use_batch_handlers(bool p_enabled) { use_batch_handlers = p_enabled; }
+	bool is_using_batch_handlers() const { return use_batch_handlers; }
+
+	Error load_profile(const String &p_path, bool p_send);
+	void clear_profile(bool p_send) { (p_send ? send_profile : receive_profile).close(); }
+	bool has_profile(bool p_send) const { return (p_send ? send_profile : receive_profile).is_open(); }
+
+	Error start_recording(const String &p_path, bool p_include_payload);
+	void stop_recording() { trace_writer.close(); }
+	bool is_recording() const { return trace_writer.is_open(); }
+	Error start_replay(const String &p_path);
+	void stop_replay();
+	bool is_replaying() const { return replay_readers[0].is_open() || replay_readers[1].is_open(); }
+
+	void set_use_delivery_thread(bool p_enabled);
+	bool is_using_delivery_thread() const { return use_delivery_thread; }
+
+	void set_use_worker_threads(bool p_enabled) { use_worker_threads = p_enabled; }
+	bool is_using_worker_threads() const { return use_worker_threads; }
+
+	void set_use_poll_profiler(bool p_enabled) { poll_profiler.set_enabled(p_enabled); }
+	bool is_using_poll_profiler() const { return poll_profiler.is_enabled(); }
+	PackedFloat64Array get_poll_samples() const;
+	double get_poll_phase_percentile(PollPhase p_phase, double p_percentile) const;
+	Error save_poll_trace(const String &p_path) const;
+	void clear_poll_samples() { poll_profiler.clear(); }
+
 	void set_delay_minimum(double p_value) { delay_minimum = Math::max(p_value, 0.0); }
 	double get_delay_minimum() const { return delay_minimum; }
 
@@ -80,15 +421,100 @@ public:
 	void set_packet_loss(double p_loss) { packet_loss = Math::clamp(p_loss, 0.0, 1.0); }
 	double get_packet_loss() const { return packet_loss; }
 
+	void set_packet_duplication(double p_probability) { packet_duplication = Math::clamp(p_probability, 0.0, 1.0); }
+	double get_packet_duplication() const { return packet_duplication; }
+
+	void set_packet_reordering(double p_probability) { packet_reordering = Math::clamp(p_probability, 0.0, 1.0); }
+	double get_packet_reordering() const { return packet_reordering; }
+
+	void set_packet_corruption(double p_probability) { packet_corruption = Math::clamp(p_probability, 0.0, 1.0); }
+	double get_packet_corruption() const { return packet_corruption; }
+
+	void set_corruption_bit_rate(double p_rate);
+	double get_corruption_bit_rate() const { return corruption_bit_rate; }
+
+	void set_retry_timeout(double p_value);
+	double get_retry_timeout() const { return settings.retry_timeout; }
+
+	void set_retry_backoff(double p_value);
+	double get_retry_backoff() const { return settings.retry_backoff; }
+
+	void set_retry_timeout_maximum(double p_value);
+	double get_retry_timeout_maximum() const { return settings.retry_timeout_maximum; }
+
+	void set_send_bandwidth(double p_bytes_per_second);
+	double get_send_bandwidth() const { return send_bandwidth; }
+
+	void set_receive_bandwidth(double p_bytes_per_second);
+	double get_receive_bandwidth() const { return receive_bandwidth; }
+
+	void set_link_burst(int32_t p_bytes);
+	int32_t get_link_burst() const { return settings.send_link.burst; }
+
+	void set_link_queue_size(int32_t p_bytes);
+	int32_t get_link_queue_size() const { return settings.send_link.queue_size; }
+
+	void set_link_queue_policy(LinkQueuePolicy p_policy);
+	LinkQueuePolicy get_link_queue_policy() const { return settings.send_link.random_early_detection ? LINK_QUEUE_RED : LINK_QUEUE_DROP_TAIL; }
+
+	void set_link_mtu(int32_t p_bytes);
+	int32_t get_link_mtu() const { return settings.send_link.mtu; }
+
+	void set_link_overhead(int32_t p_bytes);
+	int32_t get_link_overhead() const { return settings.send_link.overhead; }
+
+	double get_link_backlog(int32_t p_peer, bool p_send) const;
+
+	void set_max_queued_packets(int64_t p_packets);
+	int64_t get_max_queued_packets() const { return settings.queue_limits.max_packets; }
+
+	void set_max_queued_bytes(int64_t p_bytes);
+	int64_t get_max_queued_bytes() const { return settings.queue_limits.max_bytes; }
+
+	void set_max_queued_packets_per_peer(int64_t p_packets);
+	int64_t get_max_queued_packets_per_peer() const { return settings.queue_limits.max_peer_packets; }
+
+	void set_max_queued_bytes_per_peer(int64_t p_bytes);
+	int64_t get_max_queued_bytes_per_peer() const { return settings.queue_limits.max_peer_bytes; }
+
+	void set_queue_overflow_policy(QueueOverflowPolicy p_policy);
+	QueueOverflowPolicy get_queue_overflow_policy() const { return settings.queue_overflow_policy; }
+
+	Dictionary get_memory_usage() const;
+
+	const LaggyPacketPool &get_packet_pool() const { return packet_pool; }
+
+	Dictionary get_stats() const;
+	void reset_stats();
+	double get_delay_percentile(double p_percentile, bool p_send) const;
+	double get_residence_percentile(double p_percentile, bool p_send) const;
+
+	void set_monitor_category(const String &p_category) { update_monitors(p_category); }
+	String get_monitor_category() const { return monitor_category; }
+
+	void set_impairment(const Ref<LaggyImpairment> &p_impairment);
+	Ref<LaggyImpairment> get_impairment() const { return impairment; }
+
+	void set_rule_set(const Ref<LaggyRuleSet> &p_rule_set) { rule_set = p_rule_set; }
+	Ref<LaggyRuleSet> get_rule_set() const { return rule_set; }
+	void set_scenario(const Ref<LaggyScenario> &p_scenario);
+	Ref<LaggyScenario> get_scenario() const { return scenario; }
+	void restart_scenario();
+	double get_scenario_time() const { return get_time() - scenario_start_time; }
+
 	/* Virtual methods */
 	Error _get_packet(const uint8_t **r_buffer, int32_t *r_buffer_size) override;
 	Error _put_packet(const uint8_t *p_buffer, int32_t p_buffer_size) override;
-	int32_t _get_available_packet_count() const override { return available_packets.size(); }
+	int32_t _get_available_packet_count() const override { return available_packets.size() - get_next_packet_index(); }
 	int32_t _get_max_packet_size() const override { return 0; /* This is not actually used by MultiplayerPeer */ }
 	int32_t _get_packet_channel() const override;
 	TransferMode _get_packet_mode() const override;
 	int32_t _get_packet_peer() const override;
-	void _set_transfer_channel(int32_t p_channel) override { transfer_channel = p_channel; }
+	void _set_transfer_channel(int32_t p_channel) override {
+		// Channels index an array, so they can't be negative.
+		ERR_FAIL_COND(p_channel < 0);
+		transfer_channel = p_channel;
+	}
 	int32_t _get_transfer_channel() const override { return transfer_channel; }
 	void _set_transfer_mode(TransferMode p_mode) override { transfer_mode = p_mode; }
 	TransferMode _get_transfer_mode() const override { return transfer_mode; }
@@ -104,4 +530,9 @@ public:
 	ConnectionStatus _get_connection_status() const override;
 };
 
+VARIANT_ENUM_CAST(LaggyMultiplayerPeer::ClockMode);
+VARIANT_ENUM_CAST(LaggyMultiplayerPeer::LinkQueuePolicy);
+VARIANT_ENUM_CAST(LaggyMultiplayerPeer::QueueOverflowPolicy);
+VARIANT_ENUM_CAST(LaggyMultiplayerPeer::PollPhase);
+
 #endif // LAGGY_MULTIPLAYER_PEER_GDEXTENSION_H
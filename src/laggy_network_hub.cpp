@@ -0,0 +1,320 @@
+#include "laggy_network_hub.h"
+#include "callable_utils.h"
+
+#include <godot_cpp/classes/time.hpp>
+
+LaggyHubPeer::~LaggyHubPeer() {
+	if (hub.is_valid()) {
+		hub->remove_endpoint(this);
+	}
+}
+
+void LaggyHubPeer::release_current_packet() {
+	if (holding_current_packet) {
+		available_packets.pop_front();
+		holding_current_packet = false;
+	}
+}
+
+void LaggyHubPeer::receive(LaggyPacket &&p_packet) {
+	// Channels are keyed by sender, so sequences are generated per sender, like on the sending side of a real transport.
+	LaggyPacketChannel &channel = incoming.get_channel(p_packet.peer, p_packet.channel);
+	channel.generate_sequence(p_packet);
+	channel.count_queued(p_packet);
+	schedule(std::move(p_packet), channel);
+}
+
+void LaggyHubPeer::schedule(LaggyPacket &&p_packet, LaggyPacketChannel &p_channel) {
+	double delay = 0.0;
+	bool drop_packet = false;
+	hub->sample(impairment_state, delay, drop_packet);
+
+	if (drop_packet) {
+		p_channel.count_dropped(p_packet, p_packet.mode == TRANSFER_MODE_RELIABLE);
+		if (p_packet.mode == TRANSFER_MODE_RELIABLE) {
+			p_packet.time_of_delivery += hub->get_retry_wait(delay);
+			p_packet.retries++;
+			retry_packets.push(std::move(p_packet));
+		}
+		return;
+	}
+
+	incoming.delay_histogram.record(delay);
+	p_packet.time_of_delivery += delay;
+	incoming.push(p_channel, std::move(p_packet));
+}
+
+void LaggyHubPeer::on_connected(Peer p_peer) {
+	incoming.add_peer(p_peer);
+	connection_events.push_back({ p_peer, true });
+}
+
+void LaggyHubPeer::on_disconnected(Peer p_peer) {
+	incoming.erase_peer(p_peer);
+	retry_packets.erase_peer(p_peer);
+	connection_events.push_back({ p_peer, false });
+}
+
+Error LaggyHubPeer::_get_packet(const uint8_t **r_buffer, int32_t *r_buffer_size) {
+	release_current_packet();
+	ERR_FAIL_COND_V(available_packets.is_empty(), ERR_UNAVAILABLE);
+	const LaggyPacket &packet = available_packets.front();
+	*r_buffer = packet.data.ptr();
+	*r_buffer_size = packet.data.size();
+	holding_current_packet = true;
+	return OK;
+}
+
+Error LaggyHubPeer::_put_packet(const uint8_t *p_buffer, int32_t p_buffer_size) {
+	ERR_FAIL_COND_V(hub.is_null() || connection_status != CONNECTION_CONNECTED, ERR_UNCONFIGURED);
+
+	// Copied once, then shared by every endpoint the packet is sent to.
+	LaggyPacketData data = hub->packet_pool.copy(p_buffer, p_buffer_size);
+	ERR_FAIL_COND_V(data.is_null(), ERR_OUT_OF_MEMORY);
+	hub->send(this, std::move(data), target_peer);
+	return OK;
+}
+
+int32_t LaggyHubPeer::_get_packet_channel() const {
+	ERR_FAIL_COND_V(_get_available_packet_count() == 0, 0);
+	return available_packets[get_next_packet_index()].channel;
+}
+
+MultiplayerPeer::TransferMode LaggyHubPeer::_get_packet_mode() const {
+	ERR_FAIL_COND_V(_get_available_packet_count() == 0, TRANSFER_MODE_RELIABLE);
+	return available_packets[get_next_packet_index()].mode;
+}
+
+int32_t LaggyHubPeer::_get_packet_peer() const {
+	ERR_FAIL_COND_V(_get_available_packet_count() == 0, 0);
+	return available_packets[get_next_packet_index()].peer;
+}
+
+void LaggyHubPeer::_poll() {
+	// Handlers of these signals may close this endpoint or connect new ones, so they work on a copy.
+	LocalVector<ConnectionEvent> events = connection_events;
+	connection_events.clear();
+	for (const ConnectionEvent &event : events) {
+		emit_signal(event.connected ? SNAME("peer_connected") : SNAME("peer_disconnected"), event.peer);
+	}
+
+	if (hub.is_null() || connection_status != CONNECTION_CONNECTED) {
+		return;
+	}
+	double time = hub->get_time();
+
+	// Retried packets are scheduled from the time they were due, so the result doesn't depend on how often this is polled.
+	LocalVector<LaggyPacket> retried;
+	while (retry_packets.has_due(time)) {
+		retried.push_back(retry_packets.pop());
+	}
+	for (LaggyPacket &packet : retried) {
+		LaggyPacketChannel &channel = incoming.get_channel(packet.peer, packet.channel);
+		schedule(std::move(packet), channel);
+	}
+
+	incoming.take_due(time, [&](LaggyPacket &packet) {
+		available_packets.push_back(std::move(packet));
+	});
+}
+
+void LaggyHubPeer::_close() {
+	if (hub.is_valid()) {
+		hub->remove_endpoint(this);
+	}
+	incoming.clear();
+	retry_packets.clear();
+	available_packets.clear();
+	holding_current_packet = false;
+	connection_events.clear();
+}
+
+void LaggyHubPeer::_disconnect_peer(int32_t p_peer, bool) {
+	ERR_FAIL_COND(hub.is_null() || connection_status != CONNECTION_CONNECTED);
+	if (!_is_server()) {
+		ERR_FAIL_COND(p_peer != TARGET_PEER_SERVER);
+		_close();
+		return;
+	}
+	LaggyHubPeer **client = hub->endpoints.getptr(p_peer);
+	ERR_FAIL_COND_MSG(!client || p_peer == TARGET_PEER_SERVER, vformat("Peer %d is not connected to this server.", p_peer));
+	(*client)->on_disconnected(TARGET_PEER_SERVER);
+	hub->remove_endpoint(*client);
+}
+
+void LaggyHubPeer::_bind_methods() {
+	ClassDB::bind_method(D_METHOD("get_hub"), &LaggyHubPeer::get_hub);
+}
+
+static double get_real_time() {
+	static Time *time = Time::get_singleton();
+	return time->get_ticks_usec() / 1'000'000.0;
+}
+
+LaggyHubPeer *LaggyNetworkHub::get_server() const {
+	LaggyHubPeer *const *server = endpoints.getptr(MultiplayerPeer::TARGET_PEER_SERVER);
+	return server ? *server : nullptr;
+}
+
+Ref<LaggyHubPeer> LaggyNetworkHub::create_endpoint(Peer p_id) {
+	Ref<LaggyHubPeer> endpoint;
+	endpoint.instantiate();
+	endpoint->hub = Ref<LaggyNetworkHub>(this);
+	endpoint->unique_id = p_id;
+	endpoints.insert(p_id, endpoint.ptr());
+	return endpoint;
+}
+
+void LaggyNetworkHub::connect_endpoints(LaggyHubPeer *p_server, LaggyHubPeer *p_client) {
+	if (p_server->refuse_new_connections) {
+		remove_endpoint(p_client);
+		return;
+	}
+	p_client->connection_status = MultiplayerPeer::CONNECTION_CONNECTED;
+	p_server->on_connected(p_client->unique_id);
+	p_client->on_connected(MultiplayerPeer::TARGET_PEER_SERVER);
+}
+
+void LaggyNetworkHub::remove_endpoint(LaggyHubPeer *p_endpoint) {
+	LaggyHubPeer **registered = endpoints.getptr(p_endpoint->unique_id);
+	if (!registered || *registered != p_endpoint) {
+		return;
+	}
+	endpoints.erase(p_endpoint->unique_id);
+	bool was_connected = p_endpoint->connection_status == MultiplayerPeer::CONNECTION_CONNECTED;
+	p_endpoint->connection_status = MultiplayerPeer::CONNECTION_DISCONNECTED;
+
+	if (p_endpoint->_is_server()) {
+		// Clients can't outlive their server, including the ones still waiting for it.
+		LocalVector<LaggyHubPeer *> clients;
+		for (const KeyValue<Peer, LaggyHubPeer *> &endpoint : endpoints) {
+			clients.push_back(endpoint.value);
+		}
+		for (LaggyHubPeer *client : clients) {
+			if (client->connection_status == MultiplayerPeer::CONNECTION_CONNECTED) {
+				client->on_disconnected(MultiplayerPeer::TARGET_PEER_SERVER);
+			}
+			remove_endpoint(client);
+		}
+	} else if (was_connected) {
+		if (LaggyHubPeer *server = get_server()) {
+			server->on_disconnected(p_endpoint->unique_id);
+		}
+	}
+}
+
+void LaggyNetworkHub::send(LaggyHubPeer *p_sender, LaggyPacketData &&p_data, Peer p_target) {
+	double time = get_time();
+	LaggyPacket packet = {
+		std::move(p_data),
+		p_sender->transfer_mode,
+		0,
+		p_sender->transfer_channel,
+		p_sender->unique_id,
+		time,
+		time,
+	};
+
+	if (!p_sender->_is_server()) {
+		// Clients are only connected to the server. Sending to other clients goes through the server's relay.
+		ERR_FAIL_COND_MSG(p_target > 0 && p_target != MultiplayerPeer::TARGET_PEER_SERVER, vformat("Clients can only send packets to the server, not to peer %d.", p_target));
+		LaggyHubPeer *server = get_server();
+		if (server && p_target != -MultiplayerPeer::TARGET_PEER_SERVER) {
+			server->receive(std::move(packet));
+		}
+		return;
+	}
+
+	if (p_target > 0) {
+		LaggyHubPeer **client = endpoints.getptr(p_target);
+		ERR_FAIL_COND_MSG(!client || (*client)->connection_status != MultiplayerPeer::CONNECTION_CONNECTED, vformat("Peer %d is not connected to this server.", p_target));
+		(*client)->receive(std::move(packet));
+		return;
+	}
+
+	// Each client gets its own handle to the same payload, and its own delay and loss.
+	for (const KeyValue<Peer, LaggyHubPeer *> &endpoint : endpoints) {
+		LaggyHubPeer *client = endpoint.value;
+		if (client == p_sender || endpoint.key == -p_target || client->connection_status != MultiplayerPeer::CONNECTION_CONNECTED) {
+			continue;
+		}
+		LaggyPacket copy = packet;
+		client->receive(std::move(copy));
+	}
+}
+
+void LaggyNetworkHub::sample(LaggyImpairment::State &p_state, double &out_delay, bool &out_drop_packet) {
+	if (impairment.is_valid()) {
+		impairment->sample(*rng.ptr(), p_state, out_delay, out_drop_packet);
+	} else {
+		out_delay = 0.0;
+		out_drop_packet = false;
+	}
+}
+
+Ref<LaggyHubPeer> LaggyNetworkHub::create_server() {
+	ERR_FAIL_COND_V_MSG(get_server() != nullptr, Ref<LaggyHubPeer>(), "This hub already has a server.");
+	Ref<LaggyHubPeer> server = create_endpoint(MultiplayerPeer::TARGET_PEER_SERVER);
+	server->connection_status = MultiplayerPeer::CONNECTION_CONNECTED;
+
+	LocalVector<LaggyHubPeer *> clients;
+	for (const KeyValue<Peer, LaggyHubPeer *> &endpoint : endpoints) {
+		if (endpoint.value != server.ptr()) {
+			clients.push_back(endpoint.value);
+		}
+	}
+	for (LaggyHubPeer *client : clients) {
+		connect_endpoints(server.ptr(), client);
+	}
+	return server;
+}
+
+Ref<LaggyHubPeer> LaggyNetworkHub::create_client() {
+	Ref<LaggyHubPeer> client = create_endpoint(next_client_id++);
+	// Waits for the server, if it hasn't been created yet.
+	client->connection_status = MultiplayerPeer::CONNECTION_CONNECTING;
+	if (LaggyHubPeer *server = get_server()) {
+		connect_endpoints(server, client.ptr());
+	}
+	return client;
+}
+
+void LaggyNetworkHub::set_clock_mode(ClockMode p_mode) {
+	if (p_mode == clock_mode) {
+		return;
+	}
+	// Continue from the current time, so packets that are already queued keep their delays.
+	manual_time = get_real_time();
+	clock_mode = p_mode;
+}
+
+void LaggyNetworkHub::advance_time(double p_seconds) {
+	ERR_FAIL_COND_MSG(clock_mode != LaggyMultiplayerPeer::CLOCK_MANUAL, "Time can only be advanced when clock_mode is CLOCK_MANUAL.");
+	ERR_FAIL_COND(p_seconds < 0.0);
+	manual_time += p_seconds;
+}
+
+double LaggyNetworkHub::get_time() const {
+	return clock_mode == LaggyMultiplayerPeer::CLOCK_MANUAL ? manual_time : get_real_time();
+}
+
+void LaggyNetworkHub::_bind_methods() {
+	ClassDB::bind_method(D_METHOD("create_server"), &LaggyNetworkHub::create_server);
+	ClassDB::bind_method(D_METHOD("create_client"), &LaggyNetworkHub::create_client);
+	ClassDB::bind_method(D_METHOD("get_endpoint_count"), &LaggyNetworkHub::get_endpoint_count);
+	ClassDB::bind_method(D_METHOD("set_impairment", "impairment"), &LaggyNetworkHub::set_impairment);
+	ClassDB::bind_method(D_METHOD("get_impairment"), &LaggyNetworkHub::get_impairment);
+	ClassDB::bind_method(D_METHOD("set_retry_timeout", "timeout"), &LaggyNetworkHub::set_retry_timeout);
+	ClassDB::bind_method(D_METHOD("get_retry_timeout"), &LaggyNetworkHub::get_retry_timeout);
+	ClassDB::bind_method(D_METHOD("set_seed", "seed"), &LaggyNetworkHub::set_seed);
+	ClassDB::bind_method(D_METHOD("get_seed"), &LaggyNetworkHub::get_seed);
+	ClassDB::bind_method(D_METHOD("set_clock_mode", "mode"), &LaggyNetworkHub::set_clock_mode);
+	ClassDB::bind_method(D_METHOD("get_clock_mode"), &LaggyNetworkHub::get_clock_mode);
+	ClassDB::bind_method(D_METHOD("advance_time", "seconds"), &LaggyNetworkHub::advance_time);
+	ClassDB::bind_method(D_METHOD("get_time"), &LaggyNetworkHub::get_time);
+
+	ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "impairment", PROPERTY_HINT_RESOURCE_TYPE, "LaggyImpairment"), "set_impairment", "get_impairment");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "retry_timeout"), "set_retry_timeout", "get_retry_timeout");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "seed"), "set_seed", "get_seed");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "clock_mode", PROPERTY_HINT_ENUM, "Real Time,Manual"), "set_clock_mode", "get_clock_mode");
+}
@@ -0,0 +1,150 @@
+#ifndef LAGGYMULTIPLAYERPEER_NETWORK_HUB_H
+#define LAGGYMULTIPLAYERPEER_NETWORK_HUB_H
+
+#include "laggy_impairment.h"
+#include "laggy_multiplayer_peer.h"
+#include "laggy_packet.h"
+#include "laggy_packet_pool.h"
+#include "ring_queue.h"
+
+#include <godot_cpp/classes/multiplayer_peer_extension.hpp>
+#include <godot_cpp/classes/random_number_generator.hpp>
+#include <godot_cpp/classes/ref_counted.hpp>
+#include <godot_cpp/templates/hash_map.hpp>
+
+using namespace godot;
+
+class LaggyNetworkHub;
+
+// Endpoint of a LaggyNetworkHub, which exchanges packets with the other endpoints of the same hub in memory.
+class LaggyHubPeer : public MultiplayerPeerExtension {
+	GDCLASS(LaggyHubPeer, MultiplayerPeerExtension)
+
+	friend class LaggyNetworkHub;
+
+	typedef LaggyPacket::Channel Channel;
+	typedef LaggyPacket::Peer Peer;
+
+	struct ConnectionEvent {
+		Peer peer = 0;
+		bool connected = false;
+	};
+
+	// Declared first so it is released last, after every packet that belongs to its pool.
+	Ref<LaggyNetworkHub> hub;
+	Peer unique_id = 0;
+	ConnectionStatus connection_status = CONNECTION_DISCONNECTED;
+	bool refuse_new_connections = false;
+
+	// Packets sent to this endpoint, by sender and channel, until their delay has passed.
+	LaggyChannelMap incoming;
+	LaggyPacketQueue retry_packets;
+	LaggyImpairment::State impairment_state;
+	RingQueue<LaggyPacket> available_packets;
+	bool holding_current_packet = false;
+	// Emitted as signals by the next poll, like a real transport would.
+	LocalVector<ConnectionEvent> connection_events;
+
+	TransferMode transfer_mode = TRANSFER_MODE_RELIABLE;
+	Channel transfer_channel = 0;
+	Peer target_peer = 0;
+
+	_FORCE_INLINE_ uint32_t get_next_packet_index() const { return holding_current_packet ? 1 : 0; }
+	void release_current_packet();
+	void receive(LaggyPacket &&p_packet);
+	void schedule(LaggyPacket &&p_packet, LaggyPacketChannel &p_channel);
+	void on_connected(Peer p_peer);
+	void on_disconnected(Peer p_peer);
+
+protected:
+	static void _bind_methods();
+
+public:
+	Ref<LaggyNetworkHub> get_hub() const { return hub; }
+
+	/* Virtual methods */
+	Error _get_packet(const uint8_t **r_buffer, int32_t *r_buffer_size) override;
+	Error _put_packet(const uint8_t *p_buffer, int32_t p_buffer_size) override;
+	int32_t _get_available_packet_count() const override { return available_packets.size() - get_next_packet_index(); }
+	int32_t _get_max_packet_size() const override { return 0; }
+	int32_t _get_packet_channel() const override;
+	TransferMode _get_packet_mode() const override;
+	int32_t _get_packet_peer() const override;
+	void _set_transfer_channel(int32_t p_channel) override {
+		ERR_FAIL_COND(p_channel < 0);
+		transfer_channel = p_channel;
+	}
+	int32_t _get_transfer_channel() const override { return transfer_channel; }
+	void _set_transfer_mode(TransferMode p_mode) override { transfer_mode = p_mode; }
+	TransferMode _get_transfer_mode() const override { return transfer_mode; }
+	void _set_target_peer(int32_t p_peer) override { target_peer = p_peer; }
+	bool _is_server() const override { return unique_id == TARGET_PEER_SERVER; }
+	void _poll() override;
+	void _close() override;
+	void _disconnect_peer(int32_t p_peer, bool p_force) override;
+	int32_t _get_unique_id() const override { return unique_id; }
+	void _set_refuse_new_connections(bool p_enable) override { refuse_new_connections = p_enable; }
+	bool _is_refusing_new_connections() const override { return refuse_new_connections; }
+	bool _is_server_relay_supported() const override { return true; }
+	ConnectionStatus _get_connection_status() const override { return connection_status; }
+
+	~LaggyHubPeer() override;
+};
+
+// In-memory network shared by any number of LaggyHubPeer endpoints, one server and its clients.
+// Packets go through the same channels as LaggyMultiplayerPeer, and their payloads are shared instead of copied.
+// Not thread-safe: every endpoint of a hub has to be used from the same thread.
+class LaggyNetworkHub : public RefCounted {
+	GDCLASS(LaggyNetworkHub, RefCounted)
+
+	friend class LaggyHubPeer;
+
+	typedef LaggyPacket::Peer Peer;
+	typedef LaggyMultiplayerPeer::ClockMode ClockMode;
+
+	// Declared first so it is released last, after the endpoints' packets.
+	LaggyPacketPool packet_pool;
+	HashMap<Peer, LaggyHubPeer *> endpoints;
+	Peer next_client_id = FIRST_CLIENT_ID;
+
+	Ref<LaggyImpairment> impairment;
+	double retry_timeout = 0.0;
+	Ref<RandomNumberGenerator> rng = memnew(RandomNumberGenerator);
+
+	ClockMode clock_mode = LaggyMultiplayerPeer::CLOCK_REAL_TIME;
+	double manual_time = 0.0;
+
+	LaggyHubPeer *get_server() const;
+	Ref<LaggyHubPeer> create_endpoint(Peer p_id);
+	void connect_endpoints(LaggyHubPeer *p_server, LaggyHubPeer *p_client);
+	void remove_endpoint(LaggyHubPeer *p_endpoint);
+	void send(LaggyHubPeer *p_sender, LaggyPacketData &&p_data, Peer p_target);
+	void sample(LaggyImpairment::State &p_state, double &out_delay, bool &out_drop_packet);
+	double get_retry_wait(double p_delay) const { return retry_timeout > 0.0 ? retry_timeout : p_delay; }
+
+protected:
+	static void _bind_methods();
+
+public:
+	static constexpr Peer FIRST_CLIENT_ID = 2;
+
+	Ref<LaggyHubPeer> create_server();
+	Ref<LaggyHubPeer> create_client();
+	int32_t get_endpoint_count() const { return endpoints.size(); }
+
+	void set_impairment(const Ref<LaggyImpairment> &p_impairment) { impairment = p_impairment; }
+	Ref<LaggyImpairment> get_impairment() const { return impairment; }
+
+	void set_retry_timeout(double p_value) { retry_timeout = Math::max(p_value, 0.0); }
+	double get_retry_timeout() const { return retry_timeout; }
+
+	void set_seed(uint64_t p_seed) { rng->set_seed(p_seed); }
+	uint64_t get_seed() const { return rng->get_seed(); }
+
+	void set_clock_mode(ClockMode p_mode);
+	ClockMode get_clock_mode() const { return clock_mode; }
+	void advance_time(double p_seconds);
+	double get_time() const;
+};
+
+#endif //LAGGYMULTIPLAYERPEER_NETWORK_HUB_H
@@ -2,56 +2,377 @@
 
 #include "callable_utils.h"
 
-void LaggyPacketChannel::drop_out_of_order_packets() {
-	while (packets.size() > 0 && packets[0].mode == MultiplayerPeer::TRANSFER_MODE_UNRELIABLE_ORDERED && packets[0].sequence <= last_handled_ordered) {
-		packets.remove_at(0);
+void LaggyPacketQueue::erase_peer(LaggyPacket::Peer p_peer) {
+	LocalVector<LaggyPacket> kept;
+	while (!packets.is_empty()) {
+		LaggyPacket packet = pop();
+		if (packet.peer != p_peer) {
+			kept.push_back(packet);
+		}
+	}
+	// Popped in delivery order, so pushing them back keeps the order of packets with the same time.
+	for (LaggyPacket &packet : kept) {
+		push(std::move(packet));
+	}
+}
+
+void LaggyReorderBuffer::grow(uint32_t p_capacity) {
+	LocalVector<LaggyPacket> old_slots = std::move(slots);
+	LocalVector<uint8_t> old_occupied = std::move(occupied);
+	slots.resize(p_capacity);
+	occupied.resize(p_capacity);
+	memset(occupied.ptr(), 0, p_capacity);
+
+	uint32_t mask = p_capacity - 1;
+	for (uint32_t i = 0; i < old_slots.size(); i++) {
+		if (old_occupied[i]) {
+			uint32_t index = old_slots[i].sequence & mask;
+			slots[index] = std::move(old_slots[i]);
+			occupied[index] = true;
+		}
+	}
+}
+
+void LaggyReorderBuffer::insert(LaggyPacket::Sequence p_first, LaggyPacket &&p_packet) {
+	LaggyPacket::Sequence gap = p_packet.sequence - p_first;
+	if (gap >= slots.size()) {
+		uint32_t capacity = MAX(slots.size(), 16u);
+		while (capacity <= gap) {
+			capacity <<= 1;
+		}
+		grow(capacity);
+	}
+	uint32_t index = p_packet.sequence & (slots.size() - 1);
+	ERR_FAIL_COND(occupied[index]);
+	slots[index] = std::move(p_packet);
+	occupied[index] = true;
+}
+
+bool LaggyReorderBuffer::take(LaggyPacket::Sequence p_sequence, LaggyPacket &r_packet) {
+	if (slots.is_empty()) {
+		return false;
 	}
+	uint32_t index = p_sequence & (slots.size() - 1);
+	if (!occupied[index] || slots[index].sequence != p_sequence) {
+		return false;
+	}
+	r_packet = std::move(slots[index]);
+	occupied[index] = false;
+	return true;
+}
+
+void LaggyReorderBuffer::clear() {
+	slots.clear();
+	occupied.clear();
 }
 
 void LaggyPacketChannel::generate_sequence(LaggyPacket &p_packet) {
 	ERR_FAIL_COND(p_packet.sequence != 0);
 	switch (p_packet.mode) {
 		case MultiplayerPeer::TRANSFER_MODE_UNRELIABLE:
+			unreliable.generate_sequence(p_packet);
 			break;
 		case MultiplayerPeer::TRANSFER_MODE_UNRELIABLE_ORDERED:
-			p_packet.sequence = ordered_sequence++;
+			ordered.generate_sequence(p_packet);
 			break;
 		case MultiplayerPeer::TRANSFER_MODE_RELIABLE:
-			p_packet.sequence = reliable_sequence++;
+			reliable.generate_sequence(p_packet);
 			break;
 	}
 }
 
-void LaggyPacketChannel::push(const LaggyPacket &p_packet) {
+void LaggyPacketChannel::count_queued(const LaggyPacket &p_packet) {
+	counters[p_packet.mode].count_queued(p_packet.data.size());
+	totals->count_queued(p_packet.data.size());
+	peer_queued->packets.add(1);
+	peer_queued->bytes.add(p_packet.data.size());
+}
+
+void LaggyPacketChannel::count_removed(const LaggyPacket &p_packet) {
+	counters[p_packet.mode].count_removed(p_packet.data.size());
+	totals->count_removed(p_packet.data.size());
+	peer_queued->packets.sub(1);
+	peer_queued->bytes.sub(p_packet.data.size());
+}
+
+void LaggyPacketChannel::count_delivered(const LaggyPacket &p_packet) {
+	counters[p_packet.mode].delivered.add(1);
+	totals->delivered.add(1);
+	count_removed(p_packet);
+}
+
+void LaggyPacketChannel::count_dropped(const LaggyPacket &p_packet, bool p_retried) {
+	counters[p_packet.mode].dropped.add(1);
+	totals->dropped.add(1);
+	if (p_retried) {
+		counters[p_packet.mode].retried.add(1);
+		totals->retried.add(1);
+	} else {
+		count_removed(p_packet);
+	}
+}
+
+void LaggyPacketChannel::push(LaggyPacket &&p_packet) {
 	ERR_FAIL_COND(p_packet.mode != MultiplayerPeer::TRANSFER_MODE_UNRELIABLE && p_packet.sequence == 0);
-	packets.push_back(p_packet);
+	switch (p_packet.mode) {
+		case MultiplayerPeer::TRANSFER_MODE_UNRELIABLE:
+			unreliable.push(std::move(p_packet));
+			break;
+		case MultiplayerPeer::TRANSFER_MODE_UNRELIABLE_ORDERED:
+			ordered.push(std::move(p_packet));
+			break;
+		case MultiplayerPeer::TRANSFER_MODE_RELIABLE:
+			reliable.push(std::move(p_packet));
+			break;
+	}
+}
+
+template <typename DropFunc>
+bool LaggyPacketChannel::take_uncounted(double p_time, LaggyPacket &r_packet, DropFunc p_drop) {
+	// Reliable packets that were only waiting for the one delivered last go first.
+	if (reliable.take_next(-Math_INF, r_packet, p_drop)) {
+		return true;
+	}
+
+	// Otherwise the mode with the earliest packet goes first, so packets of different modes keep their delivery order.
+	while (true) {
+		double unreliable_time = unreliable.get_next_time();
+		double ordered_time = ordered.get_next_time();
+		double reliable_time = reliable.get_next_time();
+		double next_time = Math::min(unreliable_time, Math::min(ordered_time, reliable_time));
+		if (next_time > p_time) {
+			return false;
+		}
+
+		bool taken;
+		if (unreliable_time == next_time) {
+			taken = unreliable.take_next(next_time, r_packet, p_drop);
+		} else if (ordered_time == next_time) {
+			taken = ordered.take_next(next_time, r_packet, p_drop);
+		} else {
+			taken = reliable.take_next(next_time, r_packet, p_drop);
+		}
+		if (taken) {
+			return true;
+		}
+	}
 }
 
 std::optional<LaggyPacket> LaggyPacketChannel::take_next(double p_time) {
-	drop_out_of_order_packets();
-	for (Size i = 0; i < packets.size(); i++) {
-		if (const LaggyPacket &packet = packets[i]; packet.time_of_delivery <= p_time) {
-			bool consume = true;
-			switch (packet.mode) {
-				case MultiplayerPeer::TRANSFER_MODE_UNRELIABLE:
-					break;
-				case MultiplayerPeer::TRANSFER_MODE_UNRELIABLE_ORDERED:
-					last_handled_ordered = packet.sequence;
-					break;
-				case MultiplayerPeer::TRANSFER_MODE_RELIABLE:
-					if (packet.sequence == last_handled_reliable + 1) {
-						last_handled_reliable = packet.sequence;
-					} else {
-						consume = false;
-					}
-					break;
+	LaggyPacket packet;
+	auto drop = [this](const LaggyPacket &p_packet) { count_dropped(p_packet, false); };
+	if (!take_uncounted(p_time, packet, drop)) {
+		return {};
+	}
+	count_delivered(packet);
+	return packet;
+}
+
+bool LaggyPacketChannel::evict_unreliable() {
+	LaggyPacket packet;
+	bool evicted = unreliable.get_next_time() <= ordered.get_next_time() ? unreliable.evict(packet) : ordered.evict(packet);
+	if (evicted) {
+		count_dropped(packet, false);
+	}
+	return evicted;
+}
+
+const LaggyChannelMap::PeerSlot *LaggyChannelMap::find_slot(LaggyPacket::Peer p_peer) const {
+	const uint32_t *slot = slot_indices.getptr(p_peer);
+	return slot ? &slots[*slot] : nullptr;
+}
+
+LaggyPacketChannel *LaggyChannelMap::find_channel(const Deadline &p_deadline) {
+	PeerSlot &slot = slots[p_deadline.slot];
+	if (slot.generation != p_deadline.generation || uint32_t(p_deadline.channel) >= slot.channels.size()) {
+		return nullptr;
+	}
+	return &slot.channels[p_deadline.channel];
+}
+
+void LaggyChannelMap::bind_channels(PeerSlot &p_slot) {
+	for (LaggyPacketChannel &channel : p_slot.channels) {
+		if (is_channel_used(channel)) {
+			channel.peer_queued = &p_slot.queued;
+		}
+	}
+}
+
+void LaggyChannelMap::index(LaggyPacketChannel &p_channel) {
+	double next_time = p_channel.get_next_time();
+	if (next_time < p_channel.indexed_time) {
+		p_channel.indexed_time = next_time;
+		deadlines.push({ next_time, p_channel.slot, slots[p_channel.slot].generation, p_channel.id });
+	}
+}
+
+uint32_t LaggyChannelMap::add_peer(LaggyPacket::Peer p_peer) {
+	if (const uint32_t *existing = slot_indices.getptr(p_peer)) {
+		return *existing;
+	}
+
+	uint32_t index;
+	if (!free_slots.is_empty()) {
+		index = free_slots[free_slots.size() - 1];
+		free_slots.resize(free_slots.size() - 1);
+	} else {
+		index = slots.size();
+		const PeerSlot *old_slots = slots.ptr();
+		slots.resize(index + 1);
+		if (slots.ptr() != old_slots) {
+			// The slots moved, so their channels have to point at the new gauges.
+			for (uint32_t i = 0; i < index; i++) {
+				bind_channels(slots[i]);
+			}
+		}
+	}
+
+	PeerSlot &slot = slots[index];
+	slot.peer = p_peer;
+	slot.used = true;
+	slot_indices.insert(p_peer, index);
+	return index;
+}
+
+LaggyPacketChannel &LaggyChannelMap::get_channel(LaggyPacket::Peer p_peer, LaggyPacket::Channel p_channel) {
+	return get_slot_channel(add_peer(p_peer), p_channel);
+}
+
+LaggyPacketChannel *LaggyChannelMap::find_channel(LaggyPacket::Peer p_peer, LaggyPacket::Channel p_channel) {
+	const uint32_t *slot = slot_indices.getptr(p_peer);
+	return slot ? &get_slot_channel(*slot, p_channel) : nullptr;
+}
+
+LaggyPacketChannel &LaggyChannelMap::get_slot_channel(uint32_t p_slot, LaggyPacket::Channel p_channel) {
+	DEV_ASSERT(p_channel >= 0);
+	PeerSlot &slot = slots[p_slot];
+	if (uint32_t(p_channel) >= slot.channels.size()) {
+		slot.channels.resize(p_channel + 1);
+	}
+	LaggyPacketChannel &channel = slot.channels[p_channel];
+	if (!is_channel_used(channel)) {
+		channel = LaggyPacketChannel(slot.peer, p_channel, &totals, &slot.queued);
+		channel.slot = p_slot;
+	}
+	return channel;
+}
+
+void LaggyChannelMap::take_slot_due(uint32_t p_slot, const LocalVector<LaggyPacket::Channel> &p_channels, double p_time, LocalVector<LaggyPacket> &r_due, LocalVector<LaggyPacket> &r_discarded) {
+	auto discard = [&r_discarded](LaggyPacket &p_packet) { r_discarded.push_back(std::move(p_packet)); };
+	PeerSlot &slot = slots[p_slot];
+	for (LaggyPacket::Channel id : p_channels) {
+		LaggyPacketChannel &channel = slot.channels[id];
+		if (channel.get_next_time() > p_time) {
+			continue;
+		}
+		LaggyPacket packet;
+		while (channel.take_uncounted(p_time, packet, discard)) {
+			r_due.push_back(std::move(packet));
+		}
+	}
+}
+
+bool LaggyChannelMap::transmit(const LaggyPacketChannel &p_channel, RandomNumberGenerator &p_rng, double p_time, int32_t p_size, double &r_departure) {
+	if (link_settings.bandwidth <= 0.0) {
+		r_departure = p_time;
+		return true;
+	}
+	return slots[p_channel.slot].link.transmit(link_settings, p_rng, p_time, p_size, r_departure);
+}
+
+void LaggyChannelMap::push(LaggyPacketChannel &p_channel, LaggyPacket &&p_packet) {
+	p_channel.push(std::move(p_packet));
+	index(p_channel);
+}
+
+double LaggyChannelMap::get_next_time() {
+	while (!deadlines.is_empty()) {
+		const Deadline &deadline = deadlines.top();
+		LaggyPacketChannel *channel = find_channel(deadline);
+		if (channel && channel->indexed_time == deadline.time) {
+			return deadline.time;
+		}
+		deadlines.pop();
+	}
+	return Math_INF;
+}
+
+double LaggyChannelMap::get_link_backlog(LaggyPacket::Peer p_peer, double p_time) const {
+	const PeerSlot *slot = find_slot(p_peer);
+	return slot ? slot->link.get_backlog(link_settings, p_time) : 0.0;
+}
+
+bool LaggyChannelMap::has_total_room(const LaggyQueueLimits &p_limits, int32_t p_size, uint64_t p_extra_packets, uint64_t p_extra_bytes) const {
+	if (p_limits.max_packets && totals.queued_packets.get() + p_extra_packets + 1 > p_limits.max_packets) {
+		return false;
+	}
+	return !p_limits.max_bytes || totals.queued_bytes.get() + p_extra_bytes + p_size <= p_limits.max_bytes;
+}
+
+bool LaggyChannelMap::has_peer_room(const LaggyQueueLimits &p_limits, LaggyPacket::Peer p_peer, int32_t p_size) const {
+	const PeerSlot *slot = find_slot(p_peer);
+	return p_limits.has_peer_room(slot ? slot->queued.packets.get() : 0, slot ? slot->queued.bytes.get() : 0, p_size);
+}
+
+bool LaggyChannelMap::evict_unreliable(LaggyPacket::Peer p_peer) {
+	// The channel whose unreliable packet is due first, so the packets that have waited the longest go first.
+	LaggyPacketChannel *oldest = nullptr;
+	double oldest_time = Math_INF;
+	for (PeerSlot &slot : slots) {
+		if (!slot.used || (p_peer != 0 && slot.peer != p_peer)) {
+			continue;
+		}
+		for (LaggyPacketChannel &channel : slot.channels) {
+			double time = channel.get_next_unreliable_time();
+			if (time < oldest_time) {
+				oldest_time = time;
+				oldest = &channel;
 			}
-			if (consume) {
-				std::optional result = { packet };
-				packets.remove_at(i);
-				return result;
+		}
+	}
+	return oldest && oldest->evict_unreliable();
+}
+
+void LaggyChannelMap::erase_peer(LaggyPacket::Peer p_peer) {
+	const uint32_t *index = slot_indices.getptr(p_peer);
+	if (!index) {
+		return;
+	}
+	PeerSlot &slot = slots[*index];
+	// Whatever the peer still had queued is discarded with it.
+	totals.queued_packets.sub(slot.queued.packets.get());
+	totals.queued_bytes.sub(slot.queued.bytes.get());
+
+	// Keeps the channel array's allocation for the next peer that gets this slot.
+	slot.channels.clear();
+	slot.link = LaggyLink();
+	slot.queued.packets.reset();
+	slot.queued.bytes.reset();
+	slot.peer = 0;
+	slot.generation++;
+	slot.used = false;
+	free_slots.push_back(*index);
+	slot_indices.erase(p_peer);
+}
+
+void LaggyChannelMap::clear() {
+	slots.clear();
+	free_slots.clear();
+	slot_indices.clear();
+	deadlines.clear();
+	totals.queued_packets.reset();
+	totals.queued_bytes.reset();
+}
+
+void LaggyChannelMap::reset_stats() {
+	totals.reset();
+	delay_histogram.reset();
+	residence_histogram.reset();
+	for (PeerSlot &slot : slots) {
+		for (LaggyPacketChannel &channel : slot.channels) {
+			for (LaggyTrafficCounters &counters : channel.counters) {
+				counters.reset();
 			}
 		}
 	}
-	return {};
 }
@@ -1,8 +1,14 @@
 #ifndef LAGGYMULTIPLAYERPEER_PACKET_H
 #define LAGGYMULTIPLAYERPEER_PACKET_H
 
+#include "binary_heap.h"
+#include "laggy_link.h"
+#include "laggy_packet_pool.h"
+#include "laggy_stats.h"
+
 #include <godot_cpp/classes/multiplayer_peer.hpp>
 #include <godot_cpp/templates/hash_map.hpp>
+#include <godot_cpp/templates/local_vector.hpp>
 #include <optional>
 
 using namespace godot;
@@ -13,29 +19,377 @@ struct LaggyPacket {
 	typedef int32_t Channel;
 	typedef int32_t Peer;
 
-	PackedByteArray data;
+	LaggyPacketData data;
 	TransferMode mode;
 	Sequence sequence;
 	Channel channel;
 	Peer peer;
 	double time_of_delivery;
+	// When the packet entered the simulation, kept across retries.
+	double time_queued;
+	uint32_t retries = 0;
+	// Whether duplication, reordering and corruption were already applied, which only happens once per packet.
+	bool mutated = false;
+};
+
+// Caps on the packets queued in one direction, where 0 means unlimited.
+struct LaggyQueueLimits {
+	uint64_t max_packets = 0;
+	uint64_t max_bytes = 0;
+	uint64_t max_peer_packets = 0;
+	uint64_t max_peer_bytes = 0;
+
+	_FORCE_INLINE_ bool is_limited() const { return max_packets || max_bytes || max_peer_packets || max_peer_bytes; }
+	// Whether a packet of p_size bytes fits within the caps of a peer that already has p_packets queued, taking p_bytes.
+	_FORCE_INLINE_ bool has_peer_room(uint64_t p_packets, uint64_t p_bytes, int32_t p_size) const {
+		return (!max_peer_packets || p_packets + 1 <= max_peer_packets) && (!max_peer_bytes || p_bytes + p_size <= max_peer_bytes);
+	}
+};
+
+// Packets queued for one peer, in one direction.
+struct LaggyQueueGauge {
+	LaggyCounter packets;
+	LaggyCounter bytes;
+};
+
+// Packets ordered by time of delivery, earliest first. Packets with the same time keep the order they were pushed in.
+class LaggyPacketQueue {
+	struct QueuedPacket {
+		LaggyPacket packet;
+		uint64_t order;
+	};
+
+	struct DeliveryComparator {
+		_FORCE_INLINE_ bool operator()(const QueuedPacket &p_a, const QueuedPacket &p_b) const {
+			if (p_a.packet.time_of_delivery != p_b.packet.time_of_delivery) {
+				return p_a.packet.time_of_delivery < p_b.packet.time_of_delivery;
+			}
+			return p_a.order < p_b.order;
+		}
+	};
+
+	BinaryHeap<QueuedPacket, DeliveryComparator> packets;
+	uint64_t push_count = 0;
+
+public:
+	_FORCE_INLINE_ uint32_t size() const { return packets.size(); }
+	_FORCE_INLINE_ bool is_empty() const { return packets.is_empty(); }
+	_FORCE_INLINE_ bool has_due(double p_time) const { return !packets.is_empty() && packets.top().packet.time_of_delivery <= p_time; }
+	_FORCE_INLINE_ double get_next_time() const { return packets.is_empty() ? Math_INF : packets.top().packet.time_of_delivery; }
+
+	void push(LaggyPacket &&p_packet) { packets.push({ std::move(p_packet), push_count++ }); }
+	LaggyPacket pop() { return packets.pop().packet; }
+	void erase_peer(LaggyPacket::Peer p_peer);
+	void clear() { packets.clear(); }
+};
+
+// Packets waiting for earlier sequences, in a ring indexed by sequence which grows to fit the widest gap.
+class LaggyReorderBuffer {
+	LocalVector<LaggyPacket> slots;
+	LocalVector<uint8_t> occupied;
+
+	void grow(uint32_t p_capacity);
+
+public:
+	// p_first is the earliest sequence that hasn't been delivered yet.
+	void insert(LaggyPacket::Sequence p_first, LaggyPacket &&p_packet);
+	bool take(LaggyPacket::Sequence p_sequence, LaggyPacket &r_packet);
+	void clear();
+};
+
+// Scheduled packets of one transfer mode within a channel. Specialized per mode, so each one only does the work its mode needs.
+// take_next() moves the next deliverable packet into r_packet, passing the packets it discards to p_drop.
+template <MultiplayerPeer::TransferMode Mode>
+class LaggyModeQueue;
+
+template <>
+class LaggyModeQueue<MultiplayerPeer::TRANSFER_MODE_UNRELIABLE> {
+	LaggyPacketQueue scheduled;
+
+public:
+	_FORCE_INLINE_ double get_next_time() const { return scheduled.get_next_time(); }
+	_FORCE_INLINE_ void generate_sequence(LaggyPacket &) {}
+	void push(LaggyPacket &&p_packet) { scheduled.push(std::move(p_packet)); }
+
+	bool evict(LaggyPacket &r_packet) {
+		if (scheduled.is_empty()) {
+			return false;
+		}
+		r_packet = scheduled.pop();
+		return true;
+	}
+
+	template <typename DropFunc>
+	bool take_next(double p_time, LaggyPacket &r_packet, DropFunc) {
+		if (!scheduled.has_due(p_time)) {
+			return false;
+		}
+		r_packet = scheduled.pop();
+		return true;
+	}
+};
+
+template <>
+class LaggyModeQueue<MultiplayerPeer::TRANSFER_MODE_UNRELIABLE_ORDERED> {
+	LaggyPacketQueue scheduled;
+	LaggyPacket::Sequence next_sequence = 1;
+	LaggyPacket::Sequence last_handled = 0;
+
+public:
+	_FORCE_INLINE_ double get_next_time() const { return scheduled.get_next_time(); }
+	_FORCE_INLINE_ void generate_sequence(LaggyPacket &p_packet) { p_packet.sequence = next_sequence++; }
+	void push(LaggyPacket &&p_packet) { scheduled.push(std::move(p_packet)); }
+
+	bool evict(LaggyPacket &r_packet) {
+		if (scheduled.is_empty()) {
+			return false;
+		}
+		r_packet = scheduled.pop();
+		return true;
+	}
+
+	template <typename DropFunc>
+	bool take_next(double p_time, LaggyPacket &r_packet, DropFunc p_drop) {
+		while (scheduled.has_due(p_time)) {
+			r_packet = scheduled.pop();
+			if (r_packet.sequence <= last_handled) {
+				// A newer ordered packet was already delivered, so this one is dropped.
+				p_drop(r_packet);
+				continue;
+			}
+			last_handled = r_packet.sequence;
+			return true;
+		}
+		return false;
+	}
+};
+
+template <>
+class LaggyModeQueue<MultiplayerPeer::TRANSFER_MODE_RELIABLE> {
+	LaggyPacketQueue scheduled;
+	// Packets that are due, but are waiting for an earlier sequence to be delivered first.
+	LaggyReorderBuffer pending;
+	LaggyPacket::Sequence next_sequence = 1;
+	LaggyPacket::Sequence last_handled = 0;
+
+public:
+	_FORCE_INLINE_ double get_next_time() const { return scheduled.get_next_time(); }
+	_FORCE_INLINE_ void generate_sequence(LaggyPacket &p_packet) { p_packet.sequence = next_sequence++; }
+	void push(LaggyPacket &&p_packet) { scheduled.push(std::move(p_packet)); }
+
+	template <typename DropFunc>
+	bool take_next(double p_time, LaggyPacket &r_packet, DropFunc) {
+		if (pending.take(last_handled + 1, r_packet)) {
+			last_handled++;
+			return true;
+		}
+		while (scheduled.has_due(p_time)) {
+			r_packet = scheduled.pop();
+			if (r_packet.sequence == last_handled + 1) {
+				last_handled++;
+				return true;
+			}
+			ERR_CONTINUE(r_packet.sequence <= last_handled);
+			pending.insert(last_handled + 1, std::move(r_packet));
+		}
+		return false;
+	}
 };
 
 class LaggyPacketChannel {
-	Vector<LaggyPacket> packets;
+	friend class LaggyChannelMap;
 
-	LaggyPacket::Sequence reliable_sequence = 1;
-	LaggyPacket::Sequence ordered_sequence = 1;
+	LaggyPacket::Peer peer = 0;
+	LaggyPacket::Channel id = 0;
+	// Index of the peer's slot in the channel map.
+	uint32_t slot = 0;
+	// Delivery time of this channel in its map's deadline index, or infinity when it isn't indexed.
+	double indexed_time = Math_INF;
 
-	LaggyPacket::Sequence last_handled_reliable = 0;
-	LaggyPacket::Sequence last_handled_ordered = 0;
+	LaggyModeQueue<MultiplayerPeer::TRANSFER_MODE_UNRELIABLE> unreliable;
+	LaggyModeQueue<MultiplayerPeer::TRANSFER_MODE_UNRELIABLE_ORDERED> ordered;
+	LaggyModeQueue<MultiplayerPeer::TRANSFER_MODE_RELIABLE> reliable;
 
-	void drop_out_of_order_packets();
+	// Indexed by transfer mode.
+	LaggyTrafficCounters counters[3];
+	// Counters of every channel in the same direction, owned by the channel map.
+	LaggyTrafficCounters *totals = nullptr;
+	// Packets queued for this channel's peer, owned by the channel map.
+	LaggyQueueGauge *peer_queued = nullptr;
+
+	void count_removed(const LaggyPacket &p_packet);
+	void count_delivered(const LaggyPacket &p_packet);
+	template <typename DropFunc>
+	bool take_uncounted(double p_time, LaggyPacket &r_packet, DropFunc p_drop);
 
 public:
 	void generate_sequence(LaggyPacket& p_packet);
-	void push(const LaggyPacket &p_packet);
+	void count_queued(const LaggyPacket &p_packet);
+	void count_dropped(const LaggyPacket &p_packet, bool p_retried);
+	_FORCE_INLINE_ LaggyPacket::Peer get_peer() const { return peer; }
+	_FORCE_INLINE_ LaggyPacket::Channel get_id() const { return id; }
+	_FORCE_INLINE_ const LaggyTrafficCounters &get_counters(LaggyPacket::TransferMode p_mode) const { return counters[p_mode]; }
+	void push(LaggyPacket &&p_packet);
 	std::optional<LaggyPacket> take_next(double p_time);
+	_FORCE_INLINE_ double get_next_time() const { return Math::min(unreliable.get_next_time(), Math::min(ordered.get_next_time(), reliable.get_next_time())); }
+	_FORCE_INLINE_ double get_next_unreliable_time() const { return Math::min(unreliable.get_next_time(), ordered.get_next_time()); }
+	// Drops the unreliable or unreliable ordered packet that is due first, if there is any.
+	bool evict_unreliable();
+
+	LaggyPacketChannel() {}
+	LaggyPacketChannel(LaggyPacket::Peer p_peer, LaggyPacket::Channel p_id, LaggyTrafficCounters *p_totals, LaggyQueueGauge *p_peer_queued) :
+			peer(p_peer), id(p_id), totals(p_totals), peer_queued(p_peer_queued) {}
+};
+
+// Channels of every peer in one direction, with an index of their next delivery times,
+// so that polling only visits the channels that have packets due.
+// Each peer gets a slot in a dense table, which holds its channels in an array indexed by channel number.
+// Slots are reused once their peer is erased, with a new generation so the deadlines still indexed for the old peer are skipped.
+class LaggyChannelMap {
+	struct PeerSlot {
+		LocalVector<LaggyPacketChannel> channels;
+		LaggyLink link;
+		LaggyQueueGauge queued;
+		LaggyPacket::Peer peer = 0;
+		uint32_t generation = 0;
+		bool used = false;
+	};
+
+	struct Deadline {
+		double time;
+		uint32_t slot;
+		uint32_t generation;
+		LaggyPacket::Channel channel;
+	};
+
+	struct DeadlineComparator {
+		_FORCE_INLINE_ bool operator()(const Deadline &p_a, const Deadline &p_b) const { return p_a.time < p_b.time; }
+	};
+
+	LocalVector<PeerSlot> slots;
+	LocalVector<uint32_t> free_slots;
+	HashMap<LaggyPacket::Peer, uint32_t> slot_indices;
+	// May contain outdated entries, which are skipped when they don't match the channel's indexed_time.
+	BinaryHeap<Deadline, DeadlineComparator> deadlines;
+
+	// Channel numbers below the highest one a peer used are default constructed, without totals, until they are first used.
+	_FORCE_INLINE_ static bool is_channel_used(const LaggyPacketChannel &p_channel) { return p_channel.totals != nullptr; }
+	const PeerSlot *find_slot(LaggyPacket::Peer p_peer) const;
+	LaggyPacketChannel *find_channel(const Deadline &p_deadline);
+	void bind_channels(PeerSlot &p_slot);
+	void index(LaggyPacketChannel &p_channel);
+
+public:
+	LaggyLink::Settings link_settings;
+
+	LaggyTrafficCounters totals;
+	// Delay applied to each packet, including the time spent waiting for the link.
+	LaggyHistogram delay_histogram;
+	// Time from entering the simulation to leaving it, including retries and waiting for earlier reliable packets.
+	LaggyHistogram residence_histogram;
+
+	// Gives p_peer a slot, if it doesn't have one yet. Peers that are never added get theirs when their first channel is used.
+	uint32_t add_peer(LaggyPacket::Peer p_peer);
+	// The returned channel stays valid until another channel is created, or its peer is erased.
+	LaggyPacketChannel &get_channel(LaggyPacket::Peer p_peer, LaggyPacket::Channel p_channel);
+	// Like get_channel(), but returns null instead of giving p_peer a slot when it doesn't have one.
+	LaggyPacketChannel *find_channel(LaggyPacket::Peer p_peer, LaggyPacket::Channel p_channel);
+	_FORCE_INLINE_ uint32_t get_slot_count() const { return slots.size(); }
+	_FORCE_INLINE_ bool is_slot_used(uint32_t p_slot) const { return slots[p_slot].used; }
+	_FORCE_INLINE_ LaggyPacket::Peer get_slot_peer(uint32_t p_slot) const { return slots[p_slot].peer; }
+	// Like get_channel(), for a peer that already has a slot. Only touches that slot, so each slot can be used by a different thread.
+	LaggyPacketChannel &get_slot_channel(uint32_t p_slot, LaggyPacket::Channel p_channel);
+	bool transmit(const LaggyPacketChannel &p_channel, RandomNumberGenerator &p_rng, double p_time, int32_t p_size, double &r_departure);
+	void push(LaggyPacketChannel &p_channel, LaggyPacket &&p_packet);
+	double get_next_time();
+	// Entries of the deadline index, including outdated ones that haven't been skipped yet.
+	_FORCE_INLINE_ uint32_t get_deadline_count() const { return deadlines.size(); }
+	double get_link_backlog(LaggyPacket::Peer p_peer, double p_time) const;
+	// Whether a packet of p_size bytes can be queued without going over p_limits. Packets queued elsewhere in the same direction
+	// can be counted towards the global caps with p_extra_packets and p_extra_bytes.
+	bool has_total_room(const LaggyQueueLimits &p_limits, int32_t p_size, uint64_t p_extra_packets, uint64_t p_extra_bytes) const;
+	bool has_peer_room(const LaggyQueueLimits &p_limits, LaggyPacket::Peer p_peer, int32_t p_size) const;
+	// Drops the unreliable packet of p_peer, or of any peer when 0, that is due first. Returns false if there are none.
+	bool evict_unreliable(LaggyPacket::Peer p_peer);
+	void erase_peer(LaggyPacket::Peer p_peer);
+	void clear();
+	void reset_stats();
+
+	template <typename IterFunc>
+	void for_each_peer(IterFunc p_callback) const {
+		for (const PeerSlot &slot : slots) {
+			if (slot.used) {
+				p_callback(slot.peer, slot.link, slot.queued);
+			}
+		}
+	}
+
+	template <typename IterFunc>
+	void for_each_channel(IterFunc p_callback) const {
+		for (const PeerSlot &slot : slots) {
+			for (const LaggyPacketChannel &channel : slot.channels) {
+				if (is_channel_used(channel)) {
+					p_callback(channel);
+				}
+			}
+		}
+	}
+
+	// Pops the deadlines that are due by p_time, and calls p_callback with the slot and channel number of each channel they belong to.
+	// Those channels are left out of the index until finish_slot() indexes them again, so each one is only claimed once.
+	template <typename IterFunc>
+	void claim_due(double p_time, IterFunc p_callback) {
+		while (!deadlines.is_empty() && deadlines.top().time <= p_time) {
+			Deadline deadline = deadlines.pop();
+			LaggyPacketChannel *channel = find_channel(deadline);
+			if (!channel || channel->indexed_time != deadline.time) {
+				continue;
+			}
+			channel->indexed_time = Math_INF;
+			p_callback(deadline.slot, deadline.channel);
+		}
+	}
+
+	// Takes the due packets of the given channels of one slot, like take_due(), but without counting them or updating the deadline index,
+	// so slots can be processed by different threads at the same time. finish_slot() completes the work on one thread.
+	void take_slot_due(uint32_t p_slot, const LocalVector<LaggyPacket::Channel> &p_channels, double p_time, LocalVector<LaggyPacket> &r_due, LocalVector<LaggyPacket> &r_discarded);
+
+	// p_channels are the channels that were claimed, or given packets without indexing them, which are indexed again.
+	template <typename IterFunc>
+	void finish_slot(uint32_t p_slot, double p_time, LocalVector<LaggyPacket::Channel> &p_channels, LocalVector<LaggyPacket> &p_due, LocalVector<LaggyPacket> &p_discarded, IterFunc p_callback) {
+		PeerSlot &slot = slots[p_slot];
+		for (LaggyPacket &packet : p_discarded) {
+			slot.channels[packet.channel].count_dropped(packet, false);
+		}
+		p_discarded.clear();
+		for (LaggyPacket &packet : p_due) {
+			slot.channels[packet.channel].count_delivered(packet);
+			residence_histogram.record(p_time - packet.time_queued);
+			p_callback(packet);
+		}
+		p_due.clear();
+		for (LaggyPacket::Channel channel : p_channels) {
+			index(slot.channels[channel]);
+		}
+		p_channels.clear();
+	}
+
+	template <typename IterFunc>
+	void take_due(double p_time, IterFunc p_callback) {
+		while (!deadlines.is_empty() && deadlines.top().time <= p_time) {
+			Deadline deadline = deadlines.pop();
+			LaggyPacketChannel *channel = find_channel(deadline);
+			if (!channel || channel->indexed_time != deadline.time) {
+				continue;
+			}
+			while (std::optional<LaggyPacket> packet = channel->take_next(p_time)) {
+				residence_histogram.record(p_time - packet->time_queued);
+				p_callback(packet.value());
+			}
+			channel->indexed_time = Math_INF;
+			index(*channel);
+		}
+	}
 };
 
 #endif //LAGGYMULTIPLAYERPEER_PACKET_H
@@ -0,0 +1,57 @@
+#include "laggy_packet_batch.h"
+
+#include <godot_cpp/core/class_db.hpp>
+
+void LaggyPacketBatch::set_packets(const LocalVector<LaggyPacket> &p_packets) {
+	int32_t count = p_packets.size();
+	peers.resize(count);
+	modes.resize(count);
+	channels.resize(count);
+	sizes.resize(count);
+	drop_mask.resize((count + 7) / 8);
+	drop_mask.fill(0);
+
+	int32_t *w_peers = peers.ptrw();
+	int32_t *w_modes = modes.ptrw();
+	int32_t *w_channels = channels.ptrw();
+	int32_t *w_sizes = sizes.ptrw();
+	for (int32_t i = 0; i < count; i++) {
+		const LaggyPacket &packet = p_packets[i];
+		w_peers[i] = packet.peer;
+		w_modes[i] = packet.mode;
+		w_channels[i] = packet.channel;
+		w_sizes[i] = packet.data.size();
+	}
+}
+
+bool LaggyPacketBatch::is_packet_dropped(int32_t p_index) const {
+	int32_t byte = p_index / 8;
+	return byte < drop_mask.size() && (drop_mask[byte] & (1 << (p_index % 8))) != 0;
+}
+
+void LaggyPacketBatch::drop_packet(int32_t p_index) {
+	ERR_FAIL_INDEX(p_index, get_packet_count());
+	drop_mask.ptrw()[p_index / 8] |= 1 << (p_index % 8);
+}
+
+void LaggyPacketBatch::set_drop_mask(const PackedByteArray &p_mask) {
+	ERR_FAIL_COND_MSG(p_mask.size() * 8 < get_packet_count(), vformat("Drop mask is too small for %d packets.", get_packet_count()));
+	drop_mask = p_mask;
+}
+
+void LaggyPacketBatch::_bind_methods() {
+	ClassDB::bind_method(D_METHOD("get_packet_count"), &LaggyPacketBatch::get_packet_count);
+	ClassDB::bind_method(D_METHOD("get_peers"), &LaggyPacketBatch::get_peers);
+	ClassDB::bind_method(D_METHOD("get_modes"), &LaggyPacketBatch::get_modes);
+	ClassDB::bind_method(D_METHOD("get_channels"), &LaggyPacketBatch::get_channels);
+	ClassDB::bind_method(D_METHOD("get_sizes"), &LaggyPacketBatch::get_sizes);
+	ClassDB::bind_method(D_METHOD("drop_packet", "index"), &LaggyPacketBatch::drop_packet);
+	ClassDB::bind_method(D_METHOD("set_drop_mask", "mask"), &LaggyPacketBatch::set_drop_mask);
+	ClassDB::bind_method(D_METHOD("get_drop_mask"), &LaggyPacketBatch::get_drop_mask);
+
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_INT32_ARRAY, "peers", PROPERTY_HINT_NONE, "", PROPERTY_USAGE_NONE), "", "get_peers");
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_INT32_ARRAY, "modes", PROPERTY_HINT_NONE, "", PROPERTY_USAGE_NONE), "", "get_modes");
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_INT32_ARRAY, "channels", PROPERTY_HINT_NONE, "", PROPERTY_USAGE_NONE), "", "get_channels");
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_INT32_ARRAY, "sizes", PROPERTY_HINT_NONE, "", PROPERTY_USAGE_NONE), "", "get_sizes");
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_BYTE_ARRAY, "drop_mask", PROPERTY_HINT_NONE, "", PROPERTY_USAGE_NONE), "set_drop_mask", "get_drop_mask");
+}
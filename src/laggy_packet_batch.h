@@ -0,0 +1,39 @@
+#ifndef LAGGYMULTIPLAYERPEER_PACKET_BATCH_H
+#define LAGGYMULTIPLAYERPEER_PACKET_BATCH_H
+
+#include "laggy_packet.h"
+
+#include <godot_cpp/classes/ref_counted.hpp>
+#include <godot_cpp/templates/local_vector.hpp>
+
+using namespace godot;
+
+// Packets waiting for a decision from a batch handler, stored as one packed array per field.
+class LaggyPacketBatch : public RefCounted {
+	GDCLASS(LaggyPacketBatch, RefCounted)
+
+	PackedInt32Array peers;
+	PackedInt32Array modes;
+	PackedInt32Array channels;
+	PackedInt32Array sizes;
+	PackedByteArray drop_mask;
+
+protected:
+	static void _bind_methods();
+
+public:
+	void set_packets(const LocalVector<LaggyPacket> &p_packets);
+	bool is_packet_dropped(int32_t p_index) const;
+
+	int32_t get_packet_count() const { return peers.size(); }
+	PackedInt32Array get_peers() const { return peers; }
+	PackedInt32Array get_modes() const { return modes; }
+	PackedInt32Array get_channels() const { return channels; }
+	PackedInt32Array get_sizes() const { return sizes; }
+
+	void drop_packet(int32_t p_index);
+	void set_drop_mask(const PackedByteArray &p_mask);
+	PackedByteArray get_drop_mask() const { return drop_mask; }
+};
+
+#endif //LAGGYMULTIPLAYERPEER_PACKET_BATCH_H
@@ -0,0 +1,113 @@
+#include "laggy_packet_pool.h"
+
+#include <godot_cpp/core/error_macros.hpp>
+
+void LaggyPacketData::unref() {
+	if (block && block->refcount.unref()) {
+		block->pool->release(block);
+	}
+	block = nullptr;
+}
+
+LaggyPacketData::LaggyPacketData(const LaggyPacketData &p_other) {
+	if (p_other.block && p_other.block->refcount.ref()) {
+		block = p_other.block;
+	}
+}
+
+LaggyPacketData &LaggyPacketData::operator=(const LaggyPacketData &p_other) {
+	if (block != p_other.block) {
+		unref();
+		if (p_other.block && p_other.block->refcount.ref()) {
+			block = p_other.block;
+		}
+	}
+	return *this;
+}
+
+LaggyPacketData &LaggyPacketData::operator=(LaggyPacketData &&p_other) {
+	if (this != &p_other) {
+		unref();
+		block = p_other.block;
+		p_other.block = nullptr;
+	}
+	return *this;
+}
+
+uint32_t LaggyPacketPool::get_size_class(int32_t p_size) {
+	uint32_t size_class = 0;
+	while (size_class < SIZE_CLASS_COUNT && (1 << (MIN_BLOCK_SHIFT + size_class)) < p_size) {
+		size_class++;
+	}
+	return size_class;
+}
+
+LaggyPacketData LaggyPacketPool::allocate(int32_t p_size) {
+	ERR_FAIL_COND_V(p_size < 0, LaggyPacketData());
+
+	uint32_t size_class = get_size_class(p_size);
+	Block *block = nullptr;
+	if (size_class < SIZE_CLASS_COUNT) {
+		if (thread_safe) {
+			lock.lock();
+		}
+		block = free_lists[size_class];
+		if (block) {
+			free_lists[size_class] = block->next_free;
+		}
+		if (thread_safe) {
+			lock.unlock();
+		}
+	}
+	if (!block) {
+		// Oversized payloads get an exact allocation, and are freed instead of pooled on release.
+		int32_t capacity = size_class < SIZE_CLASS_COUNT ? 1 << (MIN_BLOCK_SHIFT + size_class) : p_size;
+		void *memory = memalloc(sizeof(Block) + capacity);
+		ERR_FAIL_NULL_V(memory, LaggyPacketData());
+		block = memnew_placement(memory, Block);
+		block->pool = this;
+		block->size_class = size_class;
+		allocation_count.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	block->next_free = nullptr;
+	block->refcount.init();
+	block->size = p_size;
+	return LaggyPacketData(block);
+}
+
+LaggyPacketData LaggyPacketPool::copy(const uint8_t *p_buffer, int32_t p_size) {
+	LaggyPacketData data = allocate(p_size);
+	if (!data.is_null() && p_size > 0) {
+		memcpy(data.ptrw(), p_buffer, p_size);
+	}
+	return data;
+}
+
+void LaggyPacketPool::release(Block *p_block) {
+	DEV_ASSERT(p_block->pool == this);
+	if (p_block->size_class >= SIZE_CLASS_COUNT) {
+		p_block->~Block();
+		memfree(p_block);
+		return;
+	}
+	if (thread_safe) {
+		lock.lock();
+	}
+	p_block->next_free = free_lists[p_block->size_class];
+	free_lists[p_block->size_class] = p_block;
+	if (thread_safe) {
+		lock.unlock();
+	}
+}
+
+LaggyPacketPool::~LaggyPacketPool() {
+	for (Block *&free_list : free_lists) {
+		while (free_list) {
+			Block *block = free_list;
+			free_list = block->next_free;
+			block->~Block();
+			memfree(block);
+		}
+	}
+}
@@ -0,0 +1,88 @@
+#ifndef LAGGYMULTIPLAYERPEER_PACKET_POOL_H
+#define LAGGYMULTIPLAYERPEER_PACKET_POOL_H
+
+#include <godot_cpp/core/memory.hpp>
+#include <godot_cpp/templates/safe_refcount.hpp>
+#include <godot_cpp/templates/spin_lock.hpp>
+
+#include <atomic>
+
+using namespace godot;
+
+class LaggyPacketPool;
+
+// Handle to a packet payload stored in a LaggyPacketPool block.
+// Copies share the block through its reference count, and moves transfer it without touching the count.
+// The block goes back to its pool when the last handle is released.
+class LaggyPacketData {
+	friend class LaggyPacketPool;
+
+	struct Block {
+		LaggyPacketPool *pool;
+		Block *next_free;
+		SafeRefCount refcount;
+		int32_t size;
+		uint32_t size_class;
+
+		_FORCE_INLINE_ uint8_t *data() { return reinterpret_cast<uint8_t *>(this + 1); }
+	};
+
+	Block *block = nullptr;
+
+	explicit LaggyPacketData(Block *p_block) :
+			block(p_block) {}
+
+	void unref();
+
+public:
+	_FORCE_INLINE_ bool is_null() const { return block == nullptr; }
+	_FORCE_INLINE_ int32_t size() const { return block ? block->size : 0; }
+	_FORCE_INLINE_ const uint8_t *ptr() const { return block ? block->data() : nullptr; }
+	_FORCE_INLINE_ uint8_t *ptrw() { return block ? block->data() : nullptr; }
+	// Whether other handles share the payload, in which case it has to be copied before it's written to.
+	_FORCE_INLINE_ bool is_shared() const { return block && block->refcount.get() > 1; }
+
+	LaggyPacketData() {}
+	LaggyPacketData(const LaggyPacketData &p_other);
+	LaggyPacketData(LaggyPacketData &&p_other) :
+			block(p_other.block) { p_other.block = nullptr; }
+	LaggyPacketData &operator=(const LaggyPacketData &p_other);
+	LaggyPacketData &operator=(LaggyPacketData &&p_other);
+	~LaggyPacketData() { unref(); }
+};
+
+// Size-classed free lists of payload blocks. Released blocks are kept for reuse instead of being freed,
+// so once the pool has warmed up, packets of up to MAX_POOLED_SIZE bytes never allocate.
+class LaggyPacketPool {
+	typedef LaggyPacketData::Block Block;
+
+	static constexpr uint32_t MIN_BLOCK_SHIFT = 6;
+	static constexpr uint32_t SIZE_CLASS_COUNT = 11;
+
+	Block *free_lists[SIZE_CLASS_COUNT] = {};
+	// Blocks allocated from the system, as opposed to reused from the free lists.
+	std::atomic<uint64_t> allocation_count = { 0 };
+	// Only taken when the pool is shared between threads, which are expected to hold it for a few instructions.
+	SpinLock lock;
+	bool thread_safe = false;
+
+	static uint32_t get_size_class(int32_t p_size);
+
+public:
+	static constexpr int32_t MAX_POOLED_SIZE = 1 << (MIN_BLOCK_SHIFT + SIZE_CLASS_COUNT - 1);
+
+	LaggyPacketData allocate(int32_t p_size);
+	LaggyPacketData copy(const uint8_t *p_buffer, int32_t p_size);
+	void release(Block *p_block);
+	uint64_t get_allocation_count() const { return allocation_count.load(std::memory_order_relaxed); }
+
+	// Must not be changed while other threads may be using the pool.
+	void set_thread_safe(bool p_enabled) { thread_safe = p_enabled; }
+
+	LaggyPacketPool() {}
+	LaggyPacketPool(const LaggyPacketPool &) = delete;
+	LaggyPacketPool &operator=(const LaggyPacketPool &) = delete;
+	~LaggyPacketPool();
+};
+
+#endif //LAGGYMULTIPLAYERPEER_PACKET_POOL_H
@@ -0,0 +1,115 @@
+#include "laggy_poll_profiler.h"
+
+#include <godot_cpp/classes/file_access.hpp>
+#include <godot_cpp/core/math.hpp>
+
+#include <chrono>
+
+uint64_t LaggyPollProfiler::get_ticks() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void LaggyPollProfiler::set_enabled(bool p_enabled) {
+	if (p_enabled == enabled) {
+		return;
+	}
+	enabled = p_enabled;
+	if (enabled) {
+		samples.resize(SAMPLE_COUNT);
+	} else {
+		samples.reset();
+	}
+	next_sample = 0;
+	sample_count = 0;
+	current = Sample();
+}
+
+void LaggyPollProfiler::add(uint32_t p_phase, uint64_t p_start, uint64_t p_end) {
+	ERR_FAIL_UNSIGNED_INDEX(p_phase, MAX_PHASES);
+	if (current.start[p_phase] == 0) {
+		current.start[p_phase] = p_start;
+	}
+	current.duration[p_phase] += p_end - p_start;
+}
+
+void LaggyPollProfiler::finish_sample() {
+	if (!enabled) {
+		return;
+	}
+	bool measured = false;
+	for (uint32_t phase = 0; phase < MAX_PHASES; phase++) {
+		measured = measured || current.start[phase] != 0;
+	}
+	if (!measured) {
+		return;
+	}
+	samples[next_sample] = current;
+	next_sample = (next_sample + 1) % SAMPLE_COUNT;
+	sample_count = Math::min(sample_count + 1, SAMPLE_COUNT);
+	current = Sample();
+}
+
+void LaggyPollProfiler::clear() {
+	next_sample = 0;
+	sample_count = 0;
+	current = Sample();
+}
+
+const LaggyPollProfiler::Sample &LaggyPollProfiler::get_sample(uint32_t p_index) const {
+	CRASH_BAD_UNSIGNED_INDEX(p_index, sample_count);
+	return samples[(next_sample + SAMPLE_COUNT - sample_count + p_index) % SAMPLE_COUNT];
+}
+
+uint64_t LaggyPollProfiler::get_percentile(uint32_t p_phase, double p_percentile) const {
+	ERR_FAIL_UNSIGNED_INDEX_V(p_phase, MAX_PHASES, 0);
+	if (sample_count == 0) {
+		return 0;
+	}
+	// Only computed when asked for, so recording stays a couple of additions.
+	LocalVector<uint64_t> durations;
+	durations.resize(sample_count);
+	for (uint32_t i = 0; i < sample_count; i++) {
+		durations[i] = get_sample(i).duration[p_phase];
+	}
+	durations.sort();
+	uint32_t index = uint32_t(Math::ceil(Math::clamp(p_percentile, 0.0, 1.0) * sample_count));
+	return durations[Math::max(index, 1u) - 1];
+}
+
+Error LaggyPollProfiler::save_chrome_trace(const String &p_path, const char *const *p_phase_names, uint32_t p_phase_count) const {
+	ERR_FAIL_COND_V(p_phase_count > MAX_PHASES, ERR_INVALID_PARAMETER);
+	Ref<FileAccess> file = FileAccess::open(p_path, FileAccess::WRITE);
+	if (file.is_null()) {
+		return FileAccess::get_open_error();
+	}
+
+	// Timestamps are in microseconds, counting from the start of the oldest sample.
+	uint64_t origin = UINT64_MAX;
+	for (uint32_t i = 0; i < sample_count; i++) {
+		for (uint32_t phase = 0; phase < p_phase_count; phase++) {
+			uint64_t start = get_sample(i).start[phase];
+			if (start != 0) {
+				origin = Math::min(origin, start);
+			}
+		}
+	}
+
+	file->store_string("{\"traceEvents\":[");
+	String separator = "\n";
+	for (uint32_t phase = 0; phase < p_phase_count; phase++) {
+		file->store_string(separator + vformat("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", phase + 1, p_phase_names[phase]));
+		separator = ",\n";
+	}
+	for (uint32_t i = 0; i < sample_count; i++) {
+		const Sample &sample = get_sample(i);
+		for (uint32_t phase = 0; phase < p_phase_count; phase++) {
+			if (sample.start[phase] == 0) {
+				continue;
+			}
+			// Phases that ran several times are shown as one event, from their first start.
+			file->store_string(separator + vformat("{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", p_phase_names[phase], phase + 1, (sample.start[phase] - origin) / 1000.0, sample.duration[phase] / 1000.0));
+		}
+	}
+	file->store_string("\n]}\n");
+	return OK;
+}
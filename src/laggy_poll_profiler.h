@@ -0,0 +1,91 @@
+#ifndef LAGGYMULTIPLAYERPEER_POLL_PROFILER_H
+#define LAGGYMULTIPLAYERPEER_POLL_PROFILER_H
+
+#include <godot_cpp/templates/local_vector.hpp>
+#include <godot_cpp/variant/string.hpp>
+
+using namespace godot;
+
+// Time spent in each phase of the last SAMPLE_COUNT polls, in nanoseconds. Phases are numbered by the user of the profiler.
+// A sample starts with a poll, so time measured after it, like while sending packets, is part of that poll's sample.
+class LaggyPollProfiler {
+public:
+	static constexpr uint32_t MAX_PHASES = 8;
+	static constexpr uint32_t SAMPLE_COUNT = 1024;
+
+	struct Sample {
+		// When each phase first started during the sample, or 0 if it didn't run.
+		uint64_t start[MAX_PHASES] = {};
+		// Total time spent in each phase, which may have run several times, without the exclusive phases run inside it.
+		uint64_t duration[MAX_PHASES] = {};
+	};
+
+	// Adds the time until the end of the scope to a phase, when the profiler is enabled.
+	// Scopes are exclusive by default: one opened inside another pauses it, so time is only counted by the innermost phase.
+	// A scope that isn't exclusive, like one covering a whole poll, includes the phases opened inside it instead.
+	class Scope {
+		LaggyPollProfiler *profiler;
+		Scope *parent = nullptr;
+		uint32_t phase;
+		uint64_t start;
+		bool exclusive;
+
+	public:
+		_FORCE_INLINE_ Scope(LaggyPollProfiler &p_profiler, uint32_t p_phase, bool p_exclusive = true) :
+				profiler(p_profiler.enabled ? &p_profiler : nullptr), phase(p_phase), start(profiler ? get_ticks() : 0), exclusive(p_exclusive) {
+			if (profiler && exclusive) {
+				parent = profiler->active_scope;
+				if (parent) {
+					profiler->add(parent->phase, parent->start, start);
+				}
+				profiler->active_scope = this;
+			}
+		}
+		_FORCE_INLINE_ ~Scope() {
+			if (!profiler) {
+				return;
+			}
+			uint64_t end = get_ticks();
+			profiler->add(phase, start, end);
+			if (exclusive) {
+				// The parent resumes from here.
+				profiler->active_scope = parent;
+				if (parent) {
+					parent->start = end;
+				}
+			}
+		}
+	};
+
+private:
+	// Ring of finished samples, only allocated while enabled.
+	LocalVector<Sample> samples;
+	uint32_t next_sample = 0;
+	uint32_t sample_count = 0;
+	Sample current;
+	// Innermost exclusive scope, which is paused when another one opens inside it.
+	Scope *active_scope = nullptr;
+	bool enabled = false;
+
+public:
+	// Nanoseconds of a monotonic clock, which is cheaper to read than the engine's.
+	static uint64_t get_ticks();
+
+	_FORCE_INLINE_ bool is_enabled() const { return enabled; }
+	void set_enabled(bool p_enabled);
+
+	void add(uint32_t p_phase, uint64_t p_start, uint64_t p_end);
+	// Finishes the current sample, at the start of the next poll. Samples where nothing was measured are skipped.
+	void finish_sample();
+	void clear();
+
+	_FORCE_INLINE_ uint32_t get_sample_count() const { return sample_count; }
+	// Samples from the oldest one, at 0, to the newest one.
+	const Sample &get_sample(uint32_t p_index) const;
+	uint64_t get_percentile(uint32_t p_phase, double p_percentile) const;
+
+	// Writes the samples in the Chrome trace event format, with one track per phase.
+	Error save_chrome_trace(const String &p_path, const char *const *p_phase_names, uint32_t p_phase_count) const;
+};
+
+#endif //LAGGYMULTIPLAYERPEER_POLL_PROFILER_H
@@ -0,0 +1,63 @@
+#include "laggy_profile_trace.h"
+
+bool LaggyProfileTrace::read_row(Sample &r_sample) {
+	while (!file->eof_reached()) {
+		String line = file->get_line().strip_edges();
+		if (line.is_empty() || line.begins_with("#")) {
+			continue;
+		}
+		PackedFloat64Array values = line.replace(",", " ").replace("\t", " ").split_floats(" ", false);
+		ERR_CONTINUE_MSG(values.size() < 3, vformat("Invalid row in profile trace %s: %s", file->get_path_absolute(), line));
+		r_sample.time = values[0];
+		r_sample.delay = Math::max(values[1], 0.0);
+		r_sample.loss = Math::clamp(values[2], 0.0, 1.0);
+		r_sample.bandwidth = values.size() > 3 ? values[3] : -1.0;
+		return true;
+	}
+	return false;
+}
+
+bool LaggyProfileTrace::read_next() {
+	if (read_row(next)) {
+		next.time += start_time + loop_offset - first_timestamp;
+		return true;
+	}
+
+	// The last row marks the end of the loop, so the next one starts where it did.
+	double period = current.time - (start_time + loop_offset);
+	if (period <= 0.0) {
+		return false;
+	}
+	loop_offset += period;
+	file->seek(0);
+	ERR_FAIL_COND_V(!read_row(next), false);
+	next.time += start_time + loop_offset - first_timestamp;
+	return true;
+}
+
+Error LaggyProfileTrace::open(const String &p_path, double p_start_time) {
+	file = FileAccess::open(p_path, FileAccess::READ);
+	if (file.is_null()) {
+		return FileAccess::get_open_error();
+	}
+	if (!read_row(current)) {
+		close();
+		return ERR_PARSE_ERROR;
+	}
+	first_timestamp = current.time;
+	start_time = p_start_time;
+	loop_offset = 0.0;
+	current.time = start_time;
+	has_next = read_next();
+	return OK;
+}
+
+bool LaggyProfileTrace::advance(double p_time) {
+	bool changed = false;
+	while (has_next && next.time <= p_time) {
+		current = next;
+		has_next = read_next();
+		changed = true;
+	}
+	return changed;
+}
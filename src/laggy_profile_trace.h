@@ -0,0 +1,47 @@
+#ifndef LAGGYMULTIPLAYERPEER_PROFILE_TRACE_H
+#define LAGGYMULTIPLAYERPEER_PROFILE_TRACE_H
+
+#include <godot_cpp/classes/file_access.hpp>
+
+using namespace godot;
+
+// Time series of measured link conditions, read from a text file one row at a time as time advances, and looped when it ends.
+// Each row holds a timestamp, a one-way delay and a loss probability in seconds, and optionally the available bandwidth
+// in bytes per second, separated by commas or whitespace. Lines starting with '#' are ignored.
+class LaggyProfileTrace {
+public:
+	struct Sample {
+		// Time from which the sample applies, in the clock of the peer.
+		double time = 0.0;
+		double delay = 0.0;
+		double loss = 0.0;
+		// Negative when the row doesn't specify it.
+		double bandwidth = -1.0;
+	};
+
+private:
+	Ref<FileAccess> file;
+	// Timestamp of the first row, which is played at start_time.
+	double first_timestamp = 0.0;
+	double start_time = 0.0;
+	// Added to the timestamps of the current loop.
+	double loop_offset = 0.0;
+	Sample current;
+	Sample next;
+	bool has_next = false;
+
+	bool read_row(Sample &r_sample);
+	bool read_next();
+
+public:
+	Error open(const String &p_path, double p_start_time);
+	void close() { file = Ref<FileAccess>(); }
+	_FORCE_INLINE_ bool is_open() const { return file.is_valid(); }
+
+	// Moves forward to the sample that applies at p_time, and returns whether it changed.
+	// Only reads the rows that were passed, so the cost per call is constant when called at least once per row.
+	bool advance(double p_time);
+	_FORCE_INLINE_ const Sample &get_sample() const { return current; }
+};
+
+#endif //LAGGYMULTIPLAYERPEER_PROFILE_TRACE_H
@@ -0,0 +1,195 @@
+#include "laggy_rule_set.h"
+
+#include <godot_cpp/core/class_db.hpp>
+#include <godot_cpp/core/math.hpp>
+
+bool LaggyRuleSet::sample(bool p_send, Peer p_peer, Channel p_channel, TransferMode p_mode, int32_t p_size, RandomNumberGenerator &p_rng, double &out_delay, bool &out_drop_packet) const {
+	DEV_ASSERT(uint32_t(p_mode) < MODE_COUNT);
+	uint32_t column = uint32_t(p_channel) < channel_columns.size() ? channel_columns[p_channel] : 0;
+	uint32_t cell = ((p_send ? 0 : MODE_COUNT) + p_mode) * column_count + column;
+
+	for (uint32_t i = cell_offsets[cell]; i < cell_offsets[cell + 1]; i++) {
+		const Candidate &candidate = candidates[i];
+		if ((candidate.peer != 0 && candidate.peer != p_peer) || p_size < candidate.size_minimum || p_size > candidate.size_maximum) {
+			continue;
+		}
+		const Rule &rule = rules[candidate.rule];
+		out_delay = p_rng.randf_range(rule.delay_minimum, rule.delay_maximum);
+		if (rule.packet_loss > 0.0 && p_rng.randf() < rule.packet_loss) {
+			out_drop_packet = true;
+		}
+		return true;
+	}
+	return false;
+}
+
+bool LaggyRuleSet::push_rule(const Rule &p_rule) {
+	ERR_FAIL_INDEX_V(p_rule.direction, DIRECTION_RECEIVE + 1, false);
+	ERR_FAIL_COND_V(p_rule.peer < 0, false);
+	ERR_FAIL_COND_V(p_rule.channel < ANY || p_rule.channel > MAX_CHANNEL, false);
+	ERR_FAIL_COND_V(p_rule.mode < ANY || p_rule.mode >= int32_t(MODE_COUNT), false);
+
+	Rule rule = p_rule;
+	rule.size_minimum = Math::max(rule.size_minimum, 0);
+	if (rule.size_maximum != ANY) {
+		rule.size_maximum = Math::max(rule.size_maximum, rule.size_minimum);
+	}
+	rule.delay_minimum = Math::max(rule.delay_minimum, 0.0);
+	rule.delay_maximum = Math::max(rule.delay_maximum, rule.delay_minimum);
+	rule.packet_loss = Math::clamp(rule.packet_loss, 0.0, 1.0);
+	rules.push_back(rule);
+	return true;
+}
+
+void LaggyRuleSet::compile() {
+	// Only channels named by a rule get their own column, so the table grows with the rules rather than the channels.
+	channel_columns.clear();
+	column_count = 1;
+	for (const Rule &rule : rules) {
+		if (rule.channel == ANY) {
+			continue;
+		}
+		while (channel_columns.size() <= uint32_t(rule.channel)) {
+			channel_columns.push_back(0);
+		}
+		if (channel_columns[rule.channel] == 0) {
+			channel_columns[rule.channel] = column_count++;
+		}
+	}
+
+	cell_offsets.resize(2 * MODE_COUNT * column_count + 1);
+	candidates.clear();
+	uint32_t cell = 0;
+	for (uint32_t direction = 0; direction < 2; direction++) {
+		Direction matched_direction = direction == 0 ? DIRECTION_SEND : DIRECTION_RECEIVE;
+		for (uint32_t mode = 0; mode < MODE_COUNT; mode++) {
+			for (uint32_t column = 0; column < column_count; column++) {
+				cell_offsets[cell++] = candidates.size();
+				for (uint32_t i = 0; i < rules.size(); i++) {
+					const Rule &rule = rules[i];
+					if (rule.direction != DIRECTION_BOTH && rule.direction != matched_direction) {
+						continue;
+					}
+					if (rule.mode != ANY && uint32_t(rule.mode) != mode) {
+						continue;
+					}
+					if (rule.channel != ANY && channel_columns[rule.channel] != column) {
+						continue;
+					}
+					Candidate candidate;
+					candidate.peer = rule.peer;
+					candidate.size_minimum = rule.size_minimum;
+					candidate.size_maximum = rule.size_maximum == ANY ? INT32_MAX : rule.size_maximum;
+					candidate.rule = i;
+					candidates.push_back(candidate);
+				}
+			}
+		}
+	}
+	cell_offsets[cell] = candidates.size();
+}
+
+int32_t LaggyRuleSet::add_rule(double p_delay_minimum, double p_delay_maximum, double p_packet_loss, Peer p_peer, int32_t p_channel, int32_t p_mode, Direction p_direction, int32_t p_size_minimum, int32_t p_size_maximum) {
+	Rule rule;
+	rule.direction = p_direction;
+	rule.peer = p_peer;
+	rule.channel = p_channel;
+	rule.mode = p_mode;
+	rule.size_minimum = p_size_minimum;
+	rule.size_maximum = p_size_maximum;
+	rule.delay_minimum = p_delay_minimum;
+	rule.delay_maximum = p_delay_maximum;
+	rule.packet_loss = p_packet_loss;
+	if (!push_rule(rule)) {
+		return -1;
+	}
+	compile();
+	emit_changed();
+	return rules.size() - 1;
+}
+
+void LaggyRuleSet::remove_rule(int32_t p_index) {
+	ERR_FAIL_INDEX(p_index, int32_t(rules.size()));
+	rules.remove_at(p_index);
+	compile();
+	emit_changed();
+}
+
+void LaggyRuleSet::clear_rules() {
+	rules.clear();
+	compile();
+	emit_changed();
+}
+
+Dictionary LaggyRuleSet::get_rule(int32_t p_index) const {
+	ERR_FAIL_INDEX_V(p_index, int32_t(rules.size()), Dictionary());
+	const Rule &rule = rules[p_index];
+	Dictionary result;
+	result["direction"] = rule.direction;
+	result["peer"] = rule.peer;
+	result["channel"] = rule.channel;
+	result["mode"] = rule.mode;
+	result["size_minimum"] = rule.size_minimum;
+	result["size_maximum"] = rule.size_maximum;
+	result["delay_minimum"] = rule.delay_minimum;
+	result["delay_maximum"] = rule.delay_maximum;
+	result["packet_loss"] = rule.packet_loss;
+	return result;
+}
+
+void LaggyRuleSet::_set_data(const PackedFloat64Array &p_data) {
+	ERR_FAIL_COND(p_data.size() % DATA_STRIDE != 0);
+	rules.clear();
+	const double *r = p_data.ptr();
+	for (int64_t i = 0; i < p_data.size(); i += DATA_STRIDE) {
+		Rule rule;
+		rule.direction = Direction(int32_t(r[i]));
+		rule.peer = int32_t(r[i + 1]);
+		rule.channel = int32_t(r[i + 2]);
+		rule.mode = int32_t(r[i + 3]);
+		rule.size_minimum = int32_t(r[i + 4]);
+		rule.size_maximum = int32_t(r[i + 5]);
+		rule.delay_minimum = r[i + 6];
+		rule.delay_maximum = r[i + 7];
+		rule.packet_loss = r[i + 8];
+		push_rule(rule);
+	}
+	// Compiled once for the whole set, rather than once per rule.
+	compile();
+	emit_changed();
+}
+
+PackedFloat64Array LaggyRuleSet::_get_data() const {
+	PackedFloat64Array data;
+	data.resize(rules.size() * DATA_STRIDE);
+	double *w = data.ptrw();
+	for (const Rule &rule : rules) {
+		*w++ = rule.direction;
+		*w++ = rule.peer;
+		*w++ = rule.channel;
+		*w++ = rule.mode;
+		*w++ = rule.size_minimum;
+		*w++ = rule.size_maximum;
+		*w++ = rule.delay_minimum;
+		*w++ = rule.delay_maximum;
+		*w++ = rule.packet_loss;
+	}
+	return data;
+}
+
+void LaggyRuleSet::_bind_methods() {
+	ClassDB::bind_method(D_METHOD("add_rule", "delay_minimum", "delay_maximum", "packet_loss", "peer", "channel", "mode", "direction", "size_minimum", "size_maximum"), &LaggyRuleSet::add_rule, DEFVAL(0), DEFVAL(ANY), DEFVAL(ANY), DEFVAL(DIRECTION_BOTH), DEFVAL(0), DEFVAL(ANY));
+	ClassDB::bind_method(D_METHOD("remove_rule", "index"), &LaggyRuleSet::remove_rule);
+	ClassDB::bind_method(D_METHOD("clear_rules"), &LaggyRuleSet::clear_rules);
+	ClassDB::bind_method(D_METHOD("get_rule_count"), &LaggyRuleSet::get_rule_count);
+	ClassDB::bind_method(D_METHOD("get_rule", "index"), &LaggyRuleSet::get_rule);
+	ClassDB::bind_method(D_METHOD("_set_data", "data"), &LaggyRuleSet::_set_data);
+	ClassDB::bind_method(D_METHOD("_get_data"), &LaggyRuleSet::_get_data);
+
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_FLOAT64_ARRAY, "_data", PROPERTY_HINT_NONE, "", PROPERTY_USAGE_NO_EDITOR | PROPERTY_USAGE_INTERNAL), "_set_data", "_get_data");
+
+	BIND_ENUM_CONSTANT(DIRECTION_BOTH);
+	BIND_ENUM_CONSTANT(DIRECTION_SEND);
+	BIND_ENUM_CONSTANT(DIRECTION_RECEIVE);
+	BIND_CONSTANT(ANY);
+}
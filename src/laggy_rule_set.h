@@ -0,0 +1,95 @@
+#ifndef LAGGYMULTIPLAYERPEER_RULE_SET_H
+#define LAGGYMULTIPLAYERPEER_RULE_SET_H
+
+#include "laggy_packet.h"
+
+#include <godot_cpp/classes/multiplayer_peer.hpp>
+#include <godot_cpp/classes/random_number_generator.hpp>
+#include <godot_cpp/classes/resource.hpp>
+#include <godot_cpp/templates/local_vector.hpp>
+
+using namespace godot;
+
+// Delays and losses for the packets matching some criteria, in order of priority.
+// Rules are compiled into a table by direction, mode and channel whenever they change, so matching a packet
+// only goes through the few rules that could apply to it.
+class LaggyRuleSet : public Resource {
+	GDCLASS(LaggyRuleSet, Resource)
+
+public:
+	enum Direction {
+		DIRECTION_BOTH,
+		DIRECTION_SEND,
+		DIRECTION_RECEIVE,
+	};
+
+	typedef LaggyPacket::Peer Peer;
+	typedef LaggyPacket::Channel Channel;
+	typedef MultiplayerPeer::TransferMode TransferMode;
+
+	// Criteria set to ANY match every packet.
+	static constexpr int32_t ANY = -1;
+	// Highest channel a rule can match, which bounds the size of the table.
+	static constexpr Channel MAX_CHANNEL = 4095;
+	// Values per rule in the serialized data.
+	static constexpr int32_t DATA_STRIDE = 9;
+
+	struct Rule {
+		Direction direction = DIRECTION_BOTH;
+		// 0 matches every peer.
+		Peer peer = 0;
+		int32_t channel = ANY;
+		int32_t mode = ANY;
+		int32_t size_minimum = 0;
+		int32_t size_maximum = ANY;
+		double delay_minimum = 0.0;
+		double delay_maximum = 0.0;
+		double packet_loss = 0.0;
+	};
+
+private:
+	static constexpr uint32_t MODE_COUNT = 3;
+
+	// What is left to check of a rule, once its direction, mode and channel are known to match.
+	struct Candidate {
+		Peer peer = 0;
+		int32_t size_minimum = 0;
+		int32_t size_maximum = INT32_MAX;
+		uint32_t rule = 0;
+	};
+
+	LocalVector<Rule> rules;
+
+	// Column of each channel named by a rule. Column 0 holds the rules for every other channel.
+	LocalVector<uint32_t> channel_columns;
+	uint32_t column_count = 1;
+	// Candidates of each cell, by direction, mode and column, start at the cell's offset and end at the next one's.
+	LocalVector<uint32_t> cell_offsets;
+	LocalVector<Candidate> candidates;
+
+	bool push_rule(const Rule &p_rule);
+	void compile();
+
+	void _set_data(const PackedFloat64Array &p_data);
+	PackedFloat64Array _get_data() const;
+
+protected:
+	static void _bind_methods();
+
+public:
+	LaggyRuleSet() { compile(); }
+
+	// Decides the delay of a packet with the first rule that matches it. Returns false, without touching the outputs, when none does.
+	bool sample(bool p_send, Peer p_peer, Channel p_channel, TransferMode p_mode, int32_t p_size, RandomNumberGenerator &p_rng, double &out_delay, bool &out_drop_packet) const;
+	_FORCE_INLINE_ bool is_empty() const { return rules.is_empty(); }
+
+	int32_t add_rule(double p_delay_minimum, double p_delay_maximum, double p_packet_loss, Peer p_peer, int32_t p_channel, int32_t p_mode, Direction p_direction, int32_t p_size_minimum, int32_t p_size_maximum);
+	void remove_rule(int32_t p_index);
+	void clear_rules();
+	int32_t get_rule_count() const { return rules.size(); }
+	Dictionary get_rule(int32_t p_index) const;
+};
+
+VARIANT_ENUM_CAST(LaggyRuleSet::Direction);
+
+#endif //LAGGYMULTIPLAYERPEER_RULE_SET_H
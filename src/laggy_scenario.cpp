@@ -0,0 +1,138 @@
+#include "laggy_scenario.h"
+
+#include <godot_cpp/core/class_db.hpp>
+#include <godot_cpp/core/math.hpp>
+
+#include <algorithm>
+
+void LaggyScenario::sample(double p_time, Cursor &p_cursor, Keyframe &r_conditions) const {
+	ERR_FAIL_COND(keyframes.is_empty());
+	double time = p_time;
+	double length = get_length();
+	if (loop && length > 0.0 && time >= length) {
+		time = Math::fmod(time, length);
+	}
+
+	// Only goes back to the start when the time did, which happens once per loop.
+	uint32_t segment = p_cursor.segment;
+	if (segment >= keyframes.size() || keyframes[segment].time > time) {
+		segment = 0;
+	}
+	while (segment + 1 < keyframes.size() && keyframes[segment + 1].time <= time) {
+		segment++;
+	}
+	p_cursor.segment = segment;
+
+	const Keyframe &from = keyframes[segment];
+	r_conditions = from;
+	r_conditions.time = time;
+	if (interpolation == INTERPOLATION_STEP || segment + 1 == keyframes.size() || time < from.time) {
+		return;
+	}
+
+	const Keyframe &to = keyframes[segment + 1];
+	double weight = (time - from.time) / (to.time - from.time);
+	r_conditions.delay_minimum = Math::lerp(from.delay_minimum, to.delay_minimum, weight);
+	r_conditions.delay_maximum = Math::lerp(from.delay_maximum, to.delay_maximum, weight);
+	r_conditions.packet_loss = Math::lerp(from.packet_loss, to.packet_loss, weight);
+	if (from.bandwidth >= 0.0 && to.bandwidth >= 0.0) {
+		r_conditions.bandwidth = Math::lerp(from.bandwidth, to.bandwidth, weight);
+	}
+	// Outages start and end exactly at their keyframes, rather than fading in.
+}
+
+LaggyScenario::Keyframe LaggyScenario::make_keyframe(double p_time, double p_delay_minimum, double p_delay_maximum, double p_packet_loss, double p_bandwidth, bool p_outage) {
+	Keyframe keyframe;
+	keyframe.time = Math::max(p_time, 0.0);
+	keyframe.delay_minimum = Math::max(p_delay_minimum, 0.0);
+	keyframe.delay_maximum = Math::max(p_delay_maximum, keyframe.delay_minimum);
+	keyframe.packet_loss = Math::clamp(p_packet_loss, 0.0, 1.0);
+	keyframe.bandwidth = p_bandwidth;
+	keyframe.outage = p_outage;
+	return keyframe;
+}
+
+int32_t LaggyScenario::add_keyframe(double p_time, double p_delay_minimum, double p_delay_maximum, double p_packet_loss, double p_bandwidth, bool p_outage) {
+	Keyframe keyframe = make_keyframe(p_time, p_delay_minimum, p_delay_maximum, p_packet_loss, p_bandwidth, p_outage);
+	uint32_t index = keyframes.size();
+	while (index > 0 && keyframes[index - 1].time > keyframe.time) {
+		index--;
+	}
+	keyframes.insert(index, keyframe);
+	emit_changed();
+	return index;
+}
+
+void LaggyScenario::remove_keyframe(int32_t p_index) {
+	ERR_FAIL_INDEX(p_index, int32_t(keyframes.size()));
+	keyframes.remove_at(p_index);
+	emit_changed();
+}
+
+void LaggyScenario::clear_keyframes() {
+	keyframes.clear();
+	emit_changed();
+}
+
+Dictionary LaggyScenario::get_keyframe(int32_t p_index) const {
+	ERR_FAIL_INDEX_V(p_index, int32_t(keyframes.size()), Dictionary());
+	const Keyframe &keyframe = keyframes[p_index];
+	Dictionary result;
+	result["time"] = keyframe.time;
+	result["delay_minimum"] = keyframe.delay_minimum;
+	result["delay_maximum"] = keyframe.delay_maximum;
+	result["packet_loss"] = keyframe.packet_loss;
+	result["bandwidth"] = keyframe.bandwidth;
+	result["outage"] = keyframe.outage;
+	return result;
+}
+
+void LaggyScenario::_set_data(const PackedFloat64Array &p_data) {
+	ERR_FAIL_COND(p_data.size() % DATA_STRIDE != 0);
+	keyframes.clear();
+	keyframes.reserve(p_data.size() / DATA_STRIDE);
+	const double *r = p_data.ptr();
+	for (int64_t i = 0; i < p_data.size(); i += DATA_STRIDE) {
+		keyframes.push_back(make_keyframe(r[i], r[i + 1], r[i + 2], r[i + 3], r[i + 4], r[i + 5] != 0.0));
+	}
+	// Sorted once, and stable like add_keyframe(), for data that was edited by hand.
+	std::stable_sort(keyframes.ptr(), keyframes.ptr() + keyframes.size(), [](const Keyframe &p_a, const Keyframe &p_b) { return p_a.time < p_b.time; });
+	emit_changed();
+}
+
+PackedFloat64Array LaggyScenario::_get_data() const {
+	PackedFloat64Array data;
+	data.resize(keyframes.size() * DATA_STRIDE);
+	double *w = data.ptrw();
+	for (const Keyframe &keyframe : keyframes) {
+		*w++ = keyframe.time;
+		*w++ = keyframe.delay_minimum;
+		*w++ = keyframe.delay_maximum;
+		*w++ = keyframe.packet_loss;
+		*w++ = keyframe.bandwidth;
+		*w++ = keyframe.outage ? 1.0 : 0.0;
+	}
+	return data;
+}
+
+void LaggyScenario::_bind_methods() {
+	ClassDB::bind_method(D_METHOD("add_keyframe", "time", "delay_minimum", "delay_maximum", "packet_loss", "bandwidth", "outage"), &LaggyScenario::add_keyframe, DEFVAL(-1.0), DEFVAL(false));
+	ClassDB::bind_method(D_METHOD("remove_keyframe", "index"), &LaggyScenario::remove_keyframe);
+	ClassDB::bind_method(D_METHOD("clear_keyframes"), &LaggyScenario::clear_keyframes);
+	ClassDB::bind_method(D_METHOD("get_keyframe_count"), &LaggyScenario::get_keyframe_count);
+	ClassDB::bind_method(D_METHOD("get_keyframe", "index"), &LaggyScenario::get_keyframe);
+	ClassDB::bind_method(D_METHOD("get_length"), &LaggyScenario::get_length);
+	ClassDB::bind_method(D_METHOD("set_interpolation", "interpolation"), &LaggyScenario::set_interpolation);
+	ClassDB::bind_method(D_METHOD("get_interpolation"), &LaggyScenario::get_interpolation);
+	ClassDB::bind_method(D_METHOD("set_loop", "enabled"), &LaggyScenario::set_loop);
+	ClassDB::bind_method(D_METHOD("is_looping"), &LaggyScenario::is_looping);
+	ClassDB::bind_method(D_METHOD("_set_data", "data"), &LaggyScenario::_set_data);
+	ClassDB::bind_method(D_METHOD("_get_data"), &LaggyScenario::_get_data);
+
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "interpolation", PROPERTY_HINT_ENUM, "Step,Linear"), "set_interpolation", "get_interpolation");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "loop"), "set_loop", "is_looping");
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_FLOAT64_ARRAY, "_data", PROPERTY_HINT_NONE, "", PROPERTY_USAGE_NO_EDITOR | PROPERTY_USAGE_INTERNAL), "_set_data", "_get_data");
+
+	BIND_ENUM_CONSTANT(INTERPOLATION_STEP);
+	BIND_ENUM_CONSTANT(INTERPOLATION_LINEAR);
+}
@@ -0,0 +1,73 @@
+#ifndef LAGGYMULTIPLAYERPEER_SCENARIO_H
+#define LAGGYMULTIPLAYERPEER_SCENARIO_H
+
+#include <godot_cpp/classes/resource.hpp>
+#include <godot_cpp/templates/local_vector.hpp>
+
+using namespace godot;
+
+// Timeline of link conditions, given as keyframes which are interpolated in between.
+class LaggyScenario : public Resource {
+	GDCLASS(LaggyScenario, Resource)
+
+public:
+	enum Interpolation {
+		INTERPOLATION_STEP,
+		INTERPOLATION_LINEAR,
+	};
+
+	struct Keyframe {
+		// Seconds since the start of the scenario.
+		double time = 0.0;
+		double delay_minimum = 0.0;
+		double delay_maximum = 0.0;
+		double packet_loss = 0.0;
+		// Bytes per second, or negative to use the bandwidth set on the peer.
+		double bandwidth = -1.0;
+		// Every packet is dropped until the next keyframe.
+		bool outage = false;
+	};
+
+	// Segment a peer was last sampled in, so looking up later times only moves forward from there. Owned by the peer.
+	struct Cursor {
+		uint32_t segment = 0;
+	};
+
+	// Values per keyframe in the serialized data.
+	static constexpr int32_t DATA_STRIDE = 6;
+
+private:
+	// Sorted by time. Keyframes with the same time keep the order they were added in.
+	LocalVector<Keyframe> keyframes;
+	Interpolation interpolation = INTERPOLATION_LINEAR;
+	bool loop = false;
+
+	static Keyframe make_keyframe(double p_time, double p_delay_minimum, double p_delay_maximum, double p_packet_loss, double p_bandwidth, bool p_outage);
+	void _set_data(const PackedFloat64Array &p_data);
+	PackedFloat64Array _get_data() const;
+
+protected:
+	static void _bind_methods();
+
+public:
+	// Conditions at p_time, in r_conditions. Before the first keyframe, the first one applies, and after the last one,
+	// the last one applies, unless the scenario loops.
+	void sample(double p_time, Cursor &p_cursor, Keyframe &r_conditions) const;
+
+	int32_t add_keyframe(double p_time, double p_delay_minimum, double p_delay_maximum, double p_packet_loss, double p_bandwidth, bool p_outage);
+	void remove_keyframe(int32_t p_index);
+	void clear_keyframes();
+	int32_t get_keyframe_count() const { return keyframes.size(); }
+	Dictionary get_keyframe(int32_t p_index) const;
+	double get_length() const { return keyframes.is_empty() ? 0.0 : keyframes[keyframes.size() - 1].time; }
+
+	void set_interpolation(Interpolation p_interpolation) { interpolation = p_interpolation; }
+	Interpolation get_interpolation() const { return interpolation; }
+
+	void set_loop(bool p_loop) { loop = p_loop; }
+	bool is_looping() const { return loop; }
+};
+
+VARIANT_ENUM_CAST(LaggyScenario::Interpolation);
+
+#endif //LAGGYMULTIPLAYERPEER_SCENARIO_H
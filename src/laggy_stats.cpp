@@ -0,0 +1,63 @@
+#include "laggy_stats.h"
+
+#include <godot_cpp/core/math.hpp>
+
+void LaggyTrafficCounters::reset() {
+	packets.reset();
+	bytes.reset();
+	delivered.reset();
+	dropped.reset();
+	retried.reset();
+}
+
+uint32_t LaggyHistogram::get_bucket(uint64_t p_microseconds) {
+	uint32_t value = p_microseconds > UINT32_MAX ? UINT32_MAX : uint32_t(p_microseconds);
+	if (value < SUB_BUCKET_COUNT) {
+		return value;
+	}
+	uint32_t highest_bit = 31;
+	while (!(value & (1u << highest_bit))) {
+		highest_bit--;
+	}
+	uint32_t shift = highest_bit - SUB_BUCKET_BITS;
+	return (shift + 1) * SUB_BUCKET_COUNT + ((value >> shift) & (SUB_BUCKET_COUNT - 1));
+}
+
+uint64_t LaggyHistogram::get_bucket_start(uint32_t p_bucket) {
+	if (p_bucket < SUB_BUCKET_COUNT) {
+		return p_bucket;
+	}
+	uint32_t shift = p_bucket / SUB_BUCKET_COUNT - 1;
+	return uint64_t(SUB_BUCKET_COUNT + p_bucket % SUB_BUCKET_COUNT) << shift;
+}
+
+void LaggyHistogram::record(double p_seconds) {
+	uint64_t microseconds = p_seconds > 0.0 ? uint64_t(p_seconds * 1'000'000.0) : 0;
+	buckets[get_bucket(microseconds)].add(1);
+	count.add(1);
+}
+
+double LaggyHistogram::get_percentile(double p_percentile) const {
+	uint64_t total = count.get();
+	if (total == 0) {
+		return 0.0;
+	}
+	uint64_t target = Math::max<uint64_t>(1, uint64_t(Math::ceil(Math::clamp(p_percentile, 0.0, 1.0) * total)));
+	uint64_t seen = 0;
+	for (uint32_t i = 0; i < BUCKET_COUNT; i++) {
+		seen += buckets[i].get();
+		if (seen >= target) {
+			// Middle of the bucket, which halves the worst case error of reporting either end.
+			uint64_t end = i + 1 < BUCKET_COUNT ? get_bucket_start(i + 1) : uint64_t(UINT32_MAX) + 1;
+			return (get_bucket_start(i) + end) / 2'000'000.0;
+		}
+	}
+	return get_bucket_start(BUCKET_COUNT - 1) / 1'000'000.0;
+}
+
+void LaggyHistogram::reset() {
+	for (LaggyCounter &bucket : buckets) {
+		bucket.reset();
+	}
+	count.reset();
+}
@@ -0,0 +1,82 @@
+#ifndef LAGGYMULTIPLAYERPEER_STATS_H
+#define LAGGYMULTIPLAYERPEER_STATS_H
+
+#include <godot_cpp/core/defs.hpp>
+
+#include <atomic>
+#include <cstdint>
+
+using namespace godot;
+
+// Counter with a single writer, which can be read from any thread without locking.
+// Copyable, so it can be stored inside containers that copy their elements.
+class LaggyCounter {
+	std::atomic<uint64_t> value = { 0 };
+
+public:
+	// Only the thread running the packet pipeline writes, so a plain load and store is enough, without a locked read-modify-write.
+	_FORCE_INLINE_ void add(uint64_t p_amount) { value.store(value.load(std::memory_order_relaxed) + p_amount, std::memory_order_relaxed); }
+	_FORCE_INLINE_ void sub(uint64_t p_amount) { value.store(value.load(std::memory_order_relaxed) - p_amount, std::memory_order_relaxed); }
+	_FORCE_INLINE_ uint64_t get() const { return value.load(std::memory_order_relaxed); }
+	_FORCE_INLINE_ void reset() { value.store(0, std::memory_order_relaxed); }
+
+	LaggyCounter() {}
+	LaggyCounter(const LaggyCounter &p_other) :
+			value(p_other.get()) {}
+	LaggyCounter &operator=(const LaggyCounter &p_other) {
+		value.store(p_other.get(), std::memory_order_relaxed);
+		return *this;
+	}
+};
+
+struct LaggyTrafficCounters {
+	LaggyCounter packets;
+	LaggyCounter bytes;
+	LaggyCounter delivered;
+	LaggyCounter dropped;
+	LaggyCounter retried;
+	// Packets currently inside the simulation, including reliable packets waiting to be retried.
+	LaggyCounter queued_packets;
+	LaggyCounter queued_bytes;
+
+	_FORCE_INLINE_ void count_queued(int32_t p_size) {
+		packets.add(1);
+		bytes.add(p_size);
+		queued_packets.add(1);
+		queued_bytes.add(p_size);
+	}
+
+	_FORCE_INLINE_ void count_removed(int32_t p_size) {
+		queued_packets.sub(1);
+		queued_bytes.sub(p_size);
+	}
+
+	// Cumulative counters are cleared, but the queue gauges are kept, since those packets are still queued.
+	void reset();
+};
+
+// Log-linear histogram of durations with a fixed amount of buckets, in the style of HdrHistogram.
+// Values are recorded in microseconds with 16 sub-buckets per power of two, for a relative error of about 3%, up to about 71 minutes.
+class LaggyHistogram {
+	static constexpr uint32_t SUB_BUCKET_BITS = 4;
+	static constexpr uint32_t SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+
+public:
+	static constexpr uint32_t BUCKET_COUNT = (32 - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+
+private:
+	LaggyCounter buckets[BUCKET_COUNT];
+	LaggyCounter count;
+
+	static uint32_t get_bucket(uint64_t p_microseconds);
+	static uint64_t get_bucket_start(uint32_t p_bucket);
+
+public:
+	void record(double p_seconds);
+	uint64_t get_count() const { return count.get(); }
+	// Returns the duration in seconds below which the given fraction of the recorded values fall, or 0.0 if nothing was recorded.
+	double get_percentile(double p_percentile) const;
+	void reset();
+};
+
+#endif //LAGGYMULTIPLAYERPEER_STATS_H
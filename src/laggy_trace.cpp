@@ -0,0 +1,257 @@
+#include "laggy_trace.h"
+
+#include <godot_cpp/classes/worker_thread_pool.hpp>
+
+#include <cstring>
+
+static void encode_u32(uint32_t p_value, uint8_t *r_buffer) {
+	for (int i = 0; i < 4; i++) {
+		r_buffer[i] = uint8_t(p_value >> (i * 8));
+	}
+}
+
+static void encode_u64(uint64_t p_value, uint8_t *r_buffer) {
+	for (int i = 0; i < 8; i++) {
+		r_buffer[i] = uint8_t(p_value >> (i * 8));
+	}
+}
+
+static void encode_f64(double p_value, uint8_t *r_buffer) {
+	uint64_t bits;
+	memcpy(&bits, &p_value, sizeof(bits));
+	encode_u64(bits, r_buffer);
+}
+
+static uint32_t decode_u32(const uint8_t *p_buffer) {
+	uint32_t value = 0;
+	for (int i = 0; i < 4; i++) {
+		value |= uint32_t(p_buffer[i]) << (i * 8);
+	}
+	return value;
+}
+
+static uint64_t decode_u64(const uint8_t *p_buffer) {
+	uint64_t value = 0;
+	for (int i = 0; i < 8; i++) {
+		value |= uint64_t(p_buffer[i]) << (i * 8);
+	}
+	return value;
+}
+
+static double decode_f64(const uint8_t *p_buffer) {
+	uint64_t bits = decode_u64(p_buffer);
+	double value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+void LaggyTraceRecord::encode(uint8_t *r_buffer) const {
+	encode_f64(time, r_buffer);
+	encode_f64(delay, r_buffer + 8);
+	encode_u32(uint32_t(peer), r_buffer + 16);
+	encode_u32(uint32_t(channel), r_buffer + 20);
+	encode_u32(uint32_t(size), r_buffer + 24);
+	encode_u32(retries, r_buffer + 28);
+	r_buffer[32] = direction;
+	r_buffer[33] = uint8_t(mode);
+	r_buffer[34] = flags;
+	r_buffer[35] = 0;
+}
+
+void LaggyTraceRecord::decode(const uint8_t *p_buffer) {
+	time = decode_f64(p_buffer);
+	delay = decode_f64(p_buffer + 8);
+	peer = int32_t(decode_u32(p_buffer + 16));
+	channel = int32_t(decode_u32(p_buffer + 20));
+	size = int32_t(decode_u32(p_buffer + 24));
+	retries = decode_u32(p_buffer + 28);
+	direction = Direction(p_buffer[32]);
+	mode = MultiplayerPeer::TransferMode(p_buffer[33]);
+	flags = p_buffer[34];
+}
+
+Error LaggyTraceWriter::open(const String &p_path, bool p_include_payload) {
+	close();
+	file = FileAccess::open(p_path, FileAccess::WRITE);
+	if (file.is_null()) {
+		return FileAccess::get_open_error();
+	}
+	include_payload = p_include_payload;
+	for (Buffer &buffer : buffers) {
+		buffer.data.resize(BUFFER_SIZE);
+		buffer.used = 0;
+	}
+	current = 0;
+	pending = 0;
+	encode_u32(LaggyTraceRecord::TRACE_MAGIC, buffers[current].data.ptr());
+	encode_u32(LaggyTraceRecord::TRACE_VERSION, buffers[current].data.ptr() + 4);
+	buffers[current].used = LaggyTraceRecord::HEADER_SIZE;
+	return OK;
+}
+
+void LaggyTraceWriter::close() {
+	if (file.is_null()) {
+		return;
+	}
+	// Every buffer that was handed over is written by then, so the rest goes right after them.
+	wait_for_task();
+	Buffer &buffer = buffers[current];
+	file->store_buffer(buffer.data.ptr(), buffer.used);
+	file->close();
+	file = Ref<FileAccess>();
+	for (Buffer &unused : buffers) {
+		unused.data.reset();
+		unused.used = 0;
+	}
+}
+
+void LaggyTraceWriter::write(LaggyTraceRecord p_record, const uint8_t *p_payload) {
+	ERR_FAIL_COND(file.is_null());
+	uint32_t payload_size = 0;
+	if (include_payload && p_payload) {
+		p_record.flags |= LaggyTraceRecord::FLAG_PAYLOAD;
+		payload_size = p_record.size;
+	}
+
+	uint32_t size = LaggyTraceRecord::RECORD_SIZE + payload_size;
+	if (buffers[current].used + size > buffers[current].data.size()) {
+		submit();
+		// Only records with a payload larger than a whole buffer make it grow.
+		if (size > buffers[current].data.size()) {
+			buffers[current].data.resize(size);
+		}
+	}
+	Buffer &buffer = buffers[current];
+	p_record.encode(buffer.data.ptr() + buffer.used);
+	buffer.used += LaggyTraceRecord::RECORD_SIZE;
+	if (payload_size > 0) {
+		memcpy(buffer.data.ptr() + buffer.used, p_payload, payload_size);
+		buffer.used += payload_size;
+	}
+}
+
+void LaggyTraceWriter::submit() {
+	mutex->lock();
+	pending++;
+	current = (current + 1) % BUFFER_COUNT;
+	bool start_task = !task_running;
+	task_running = true;
+	bool full = pending == BUFFER_COUNT;
+	mutex->unlock();
+
+	if (start_task) {
+		// The previous task has already run out of buffers to write, and only has to be released.
+		wait_for_task();
+		task_id = WorkerThreadPool::get_singleton()->add_native_task(&LaggyTraceWriter::write_pending_callback, this, false, "LaggyTraceWriter");
+	}
+	if (full) {
+		// The next buffer is still waiting to be written, because the file can't keep up.
+		wait_for_task();
+	}
+	buffers[current].used = 0;
+}
+
+void LaggyTraceWriter::wait_for_task() {
+	if (task_id >= 0) {
+		WorkerThreadPool::get_singleton()->wait_for_task_completion(task_id);
+		task_id = -1;
+	}
+}
+
+void LaggyTraceWriter::write_pending() {
+	// Runs until every buffer handed over is written, including the ones handed over meanwhile.
+	while (true) {
+		mutex->lock();
+		if (pending == 0) {
+			task_running = false;
+			mutex->unlock();
+			return;
+		}
+		const Buffer &buffer = buffers[(current + BUFFER_COUNT - pending) % BUFFER_COUNT];
+		mutex->unlock();
+
+		file->store_buffer(buffer.data.ptr(), buffer.used);
+
+		mutex->lock();
+		pending--;
+		mutex->unlock();
+	}
+}
+
+void LaggyTraceWriter::write_pending_callback(void *p_userdata) {
+	static_cast<LaggyTraceWriter *>(p_userdata)->write_pending();
+}
+
+Error LaggyTraceReader::open(const String &p_path, LaggyTraceRecord::Direction p_direction) {
+	close();
+	file = FileAccess::open(p_path, FileAccess::READ);
+	if (file.is_null()) {
+		return FileAccess::get_open_error();
+	}
+	direction = p_direction;
+	buffer.resize(BUFFER_SIZE);
+	position = 0;
+	end = 0;
+
+	if (!fill(LaggyTraceRecord::HEADER_SIZE) || decode_u32(buffer.ptr()) != LaggyTraceRecord::TRACE_MAGIC) {
+		close();
+		return ERR_FILE_UNRECOGNIZED;
+	}
+	if (decode_u32(buffer.ptr() + 4) != LaggyTraceRecord::TRACE_VERSION) {
+		close();
+		return ERR_FILE_UNRECOGNIZED;
+	}
+	position += LaggyTraceRecord::HEADER_SIZE;
+	return OK;
+}
+
+void LaggyTraceReader::close() {
+	if (file.is_valid()) {
+		file->close();
+		file = Ref<FileAccess>();
+	}
+	buffer.reset();
+	position = 0;
+	end = 0;
+}
+
+bool LaggyTraceReader::fill(uint32_t p_size) {
+	if (end - position >= p_size) {
+		return true;
+	}
+	// Moves the unread bytes to the front of the buffer, and reads as much as fits after them.
+	uint32_t remaining = end - position;
+	memmove(buffer.ptr(), buffer.ptr() + position, remaining);
+	position = 0;
+	end = remaining + uint32_t(file->get_buffer(buffer.ptr() + remaining, buffer.size() - remaining));
+	return end >= p_size;
+}
+
+void LaggyTraceReader::skip(uint32_t p_size) {
+	uint32_t available = end - position;
+	if (p_size <= available) {
+		position += p_size;
+		return;
+	}
+	file->seek(file->get_position() + (p_size - available));
+	position = 0;
+	end = 0;
+}
+
+bool LaggyTraceReader::next(LaggyTraceRecord &r_record) {
+	while (file.is_valid()) {
+		if (!fill(LaggyTraceRecord::RECORD_SIZE)) {
+			close();
+			return false;
+		}
+		r_record.decode(buffer.ptr() + position);
+		position += LaggyTraceRecord::RECORD_SIZE;
+		if (r_record.has_payload()) {
+			skip(r_record.size);
+		}
+		if (r_record.direction == direction) {
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,112 @@
+#ifndef LAGGYMULTIPLAYERPEER_TRACE_H
+#define LAGGYMULTIPLAYERPEER_TRACE_H
+
+#include <godot_cpp/classes/file_access.hpp>
+#include <godot_cpp/classes/multiplayer_peer.hpp>
+#include <godot_cpp/classes/mutex.hpp>
+#include <godot_cpp/templates/local_vector.hpp>
+
+using namespace godot;
+
+// One delay decision of a LaggyMultiplayerPeer, as stored in a trace file.
+// Traces start with TRACE_MAGIC and TRACE_VERSION, followed by records of RECORD_SIZE bytes in little-endian order,
+// each one followed by its payload when it has FLAG_PAYLOAD.
+struct LaggyTraceRecord {
+	enum Direction : uint8_t {
+		DIRECTION_SEND,
+		DIRECTION_RECEIVE,
+	};
+
+	enum Flags : uint8_t {
+		FLAG_DROPPED = 1 << 0,
+		FLAG_PAYLOAD = 1 << 1,
+	};
+
+	static constexpr uint32_t TRACE_MAGIC = 0x5254474c; // "LGTR"
+	static constexpr uint32_t TRACE_VERSION = 1;
+	static constexpr uint32_t HEADER_SIZE = 8;
+	static constexpr uint32_t RECORD_SIZE = 36;
+
+	// Time the decision was made, in the clock of the peer that recorded it.
+	double time = 0.0;
+	double delay = 0.0;
+	int32_t peer = 0;
+	int32_t channel = 0;
+	int32_t size = 0;
+	uint32_t retries = 0;
+	Direction direction = DIRECTION_SEND;
+	MultiplayerPeer::TransferMode mode = MultiplayerPeer::TRANSFER_MODE_RELIABLE;
+	uint8_t flags = 0;
+
+	_FORCE_INLINE_ bool is_dropped() const { return flags & FLAG_DROPPED; }
+	_FORCE_INLINE_ bool has_payload() const { return flags & FLAG_PAYLOAD; }
+
+	void encode(uint8_t *r_buffer) const;
+	void decode(const uint8_t *p_buffer);
+};
+
+// Appends records to a trace file through a fixed number of memory buffers. Each buffer is handed to a task on the WorkerThreadPool
+// once it is full, which writes it to the file, so recording never waits for the file while packets are sent.
+// Only waits when every buffer is still waiting to be written, instead of taking more memory.
+class LaggyTraceWriter {
+	static constexpr uint32_t BUFFER_SIZE = 1 << 16;
+	static constexpr uint32_t BUFFER_COUNT = 4;
+
+	struct Buffer {
+		LocalVector<uint8_t> data;
+		uint32_t used = 0;
+	};
+
+	Ref<FileAccess> file;
+	// Filled in turn. The buffers before current, up to pending of them, are waiting to be written by the task.
+	Buffer buffers[BUFFER_COUNT];
+	uint32_t current = 0;
+	uint32_t pending = 0;
+	bool include_payload = false;
+
+	// Guards pending and task_running, which are shared with the task.
+	Ref<Mutex> mutex = memnew(Mutex);
+	int64_t task_id = -1;
+	bool task_running = false;
+
+	void submit();
+	void wait_for_task();
+	void write_pending();
+	static void write_pending_callback(void *p_userdata);
+
+public:
+	Error open(const String &p_path, bool p_include_payload);
+	void close();
+	_FORCE_INLINE_ bool is_open() const { return file.is_valid(); }
+
+	void write(LaggyTraceRecord p_record, const uint8_t *p_payload);
+
+	~LaggyTraceWriter() { close(); }
+};
+
+// Reads the records of one direction from a trace file in order, through a buffer of fixed size,
+// so traces of any length can be replayed without loading them into memory.
+// Each direction has its own reader, since they are consumed at their own pace: a single reader would have to hold on to
+// the records of one direction for as long as the other one is ahead, which isn't bounded.
+class LaggyTraceReader {
+	static constexpr uint32_t BUFFER_SIZE = 1 << 16;
+
+	Ref<FileAccess> file;
+	LocalVector<uint8_t> buffer;
+	uint32_t position = 0;
+	uint32_t end = 0;
+	LaggyTraceRecord::Direction direction = LaggyTraceRecord::DIRECTION_SEND;
+
+	bool fill(uint32_t p_size);
+	void skip(uint32_t p_size);
+
+public:
+	Error open(const String &p_path, LaggyTraceRecord::Direction p_direction);
+	void close();
+	_FORCE_INLINE_ bool is_open() const { return file.is_valid(); }
+
+	// Reads the next record of this reader's direction, or closes the file and returns false when there are none left.
+	bool next(LaggyTraceRecord &r_record);
+};
+
+#endif //LAGGYMULTIPLAYERPEER_TRACE_H
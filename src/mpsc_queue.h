@@ -0,0 +1,89 @@
+#ifndef LAGGYMULTIPLAYERPEER_MPSC_QUEUE_H
+#define LAGGYMULTIPLAYERPEER_MPSC_QUEUE_H
+
+#include <godot_cpp/core/error_macros.hpp>
+#include <godot_cpp/core/memory.hpp>
+
+#include <atomic>
+
+using namespace godot;
+
+// Bounded lock-free queue for any amount of producer threads and a single consumer thread.
+// Each cell carries a sequence number telling whether it is free to be written or ready to be read,
+// so producers only contend on the enqueue position, and never wait for each other.
+template <typename T>
+class MPSCQueue {
+	struct Cell {
+		std::atomic<uint64_t> sequence = { 0 };
+		T value;
+	};
+
+	Cell *cells = nullptr;
+	uint64_t mask = 0;
+
+	alignas(64) std::atomic<uint64_t> enqueue_position = { 0 };
+	alignas(64) uint64_t dequeue_position = 0;
+
+public:
+	_FORCE_INLINE_ bool is_initialized() const { return cells != nullptr; }
+
+	// Must be called before the queue is shared with other threads. The capacity must be a power of two.
+	void init(uint32_t p_capacity) {
+		ERR_FAIL_COND(p_capacity == 0 || (p_capacity & (p_capacity - 1)) != 0);
+		if (cells) {
+			memdelete_arr(cells);
+		}
+		cells = memnew_arr(Cell, p_capacity);
+		mask = p_capacity - 1;
+		for (uint32_t i = 0; i < p_capacity; i++) {
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+		enqueue_position.store(0, std::memory_order_relaxed);
+		dequeue_position = 0;
+	}
+
+	// Returns false without taking the value if the queue is full.
+	bool try_push(T &&p_value) {
+		uint64_t position = enqueue_position.load(std::memory_order_relaxed);
+		while (true) {
+			Cell &cell = cells[position & mask];
+			int64_t difference = int64_t(cell.sequence.load(std::memory_order_acquire)) - int64_t(position);
+			if (difference == 0) {
+				if (enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+					cell.value = std::move(p_value);
+					cell.sequence.store(position + 1, std::memory_order_release);
+					return true;
+				}
+			} else if (difference < 0) {
+				return false;
+			} else {
+				position = enqueue_position.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// Must only be called by the consumer thread.
+	bool try_pop(T &r_value) {
+		Cell &cell = cells[dequeue_position & mask];
+		if (int64_t(cell.sequence.load(std::memory_order_acquire)) - int64_t(dequeue_position + 1) < 0) {
+			return false;
+		}
+		r_value = std::move(cell.value);
+		// Leaves the cell empty, so it doesn't keep its resources alive until it is reused.
+		cell.value = T();
+		cell.sequence.store(dequeue_position + mask + 1, std::memory_order_release);
+		dequeue_position++;
+		return true;
+	}
+
+	MPSCQueue() {}
+	MPSCQueue(const MPSCQueue &) = delete;
+	MPSCQueue &operator=(const MPSCQueue &) = delete;
+	~MPSCQueue() {
+		if (cells) {
+			memdelete_arr(cells);
+		}
+	}
+};
+
+#endif //LAGGYMULTIPLAYERPEER_MPSC_QUEUE_H
@@ -3,13 +3,28 @@
 #include <godot_cpp/core/defs.hpp>
 #include <godot_cpp/godot.hpp>
 
+#include "laggy_benchmark.h"
+#include "laggy_impairment.h"
+#include "laggy_loopback_peer.h"
 #include "laggy_multiplayer_peer.h"
+#include "laggy_network_hub.h"
+#include "laggy_packet_batch.h"
+#include "laggy_rule_set.h"
+#include "laggy_scenario.h"
 
 using namespace godot;
 
 void initialize_gdextension_types(ModuleInitializationLevel p_level) {
 	if (p_level == MODULE_INITIALIZATION_LEVEL_SCENE) {
+		GDREGISTER_CLASS(LaggyBenchmark);
+		GDREGISTER_CLASS(LaggyHubPeer);
+		GDREGISTER_CLASS(LaggyImpairment);
+		GDREGISTER_INTERNAL_CLASS(LaggyLoopbackPeer);
 		GDREGISTER_CLASS(LaggyMultiplayerPeer);
+		GDREGISTER_CLASS(LaggyNetworkHub);
+		GDREGISTER_CLASS(LaggyPacketBatch);
+		GDREGISTER_CLASS(LaggyRuleSet);
+		GDREGISTER_CLASS(LaggyScenario);
 	}
 }
 
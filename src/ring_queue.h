@@ -0,0 +1,61 @@
+#ifndef LAGGYMULTIPLAYERPEER_RING_QUEUE_H
+#define LAGGYMULTIPLAYERPEER_RING_QUEUE_H
+
+#include <godot_cpp/templates/local_vector.hpp>
+
+using namespace godot;
+
+// Growable FIFO over a power-of-two ring, so pushing and popping never shift the stored elements.
+template <typename T>
+class RingQueue {
+	LocalVector<T> items;
+	uint32_t head = 0;
+	uint32_t count = 0;
+
+	_FORCE_INLINE_ uint32_t mask() const { return items.size() - 1; }
+
+	void grow() {
+		uint32_t capacity = items.size();
+		LocalVector<T> grown;
+		grown.resize(capacity == 0 ? 16 : capacity * 2);
+		for (uint32_t i = 0; i < count; i++) {
+			grown[i] = std::move(items[(head + i) & mask()]);
+		}
+		items = std::move(grown);
+		head = 0;
+	}
+
+public:
+	_FORCE_INLINE_ uint32_t size() const { return count; }
+	_FORCE_INLINE_ bool is_empty() const { return count == 0; }
+
+	_FORCE_INLINE_ T &operator[](uint32_t p_index) { return items[(head + p_index) & mask()]; }
+	_FORCE_INLINE_ const T &operator[](uint32_t p_index) const { return items[(head + p_index) & mask()]; }
+
+	_FORCE_INLINE_ T &front() { return items[head]; }
+	_FORCE_INLINE_ const T &front() const { return items[head]; }
+
+	void push_back(T &&p_item) {
+		if (count == items.size()) {
+			grow();
+		}
+		items[(head + count) & mask()] = std::move(p_item);
+		count++;
+	}
+
+	void pop_front() {
+		ERR_FAIL_COND(count == 0);
+		// Reset the slot so it doesn't keep its contents alive while unused.
+		items[head] = T();
+		head = (head + 1) & mask();
+		count--;
+	}
+
+	void clear() {
+		items.clear();
+		head = 0;
+		count = 0;
+	}
+};
+
+#endif //LAGGYMULTIPLAYERPEER_RING_QUEUE_H
@@ -0,0 +1,70 @@
+#ifndef LAGGYMULTIPLAYERPEER_SPSC_QUEUE_H
+#define LAGGYMULTIPLAYERPEER_SPSC_QUEUE_H
+
+#include <godot_cpp/core/error_macros.hpp>
+#include <godot_cpp/core/memory.hpp>
+
+#include <atomic>
+
+using namespace godot;
+
+// Bounded lock-free ring for exactly one producer thread and one consumer thread.
+// Each side only writes its own index, so neither push nor pop ever needs a read-modify-write.
+template <typename T>
+class SPSCQueue {
+	T *items = nullptr;
+	uint32_t capacity = 0;
+
+	alignas(64) std::atomic<uint32_t> head = { 0 };
+	alignas(64) std::atomic<uint32_t> tail = { 0 };
+
+public:
+	_FORCE_INLINE_ bool is_initialized() const { return items != nullptr; }
+
+	// Must be called before the queue is shared with other threads. The capacity must be a power of two.
+	void init(uint32_t p_capacity) {
+		ERR_FAIL_COND(p_capacity == 0 || (p_capacity & (p_capacity - 1)) != 0);
+		if (items) {
+			memdelete_arr(items);
+		}
+		items = memnew_arr(T, p_capacity);
+		capacity = p_capacity;
+		head.store(0, std::memory_order_relaxed);
+		tail.store(0, std::memory_order_relaxed);
+	}
+
+	// Must only be called by the producer thread. Returns false without taking the value if the queue is full.
+	bool try_push(T &&p_value) {
+		uint32_t position = tail.load(std::memory_order_relaxed);
+		if (position - head.load(std::memory_order_acquire) == capacity) {
+			return false;
+		}
+		items[position & (capacity - 1)] = std::move(p_value);
+		tail.store(position + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Must only be called by the consumer thread.
+	bool try_pop(T &r_value) {
+		uint32_t position = head.load(std::memory_order_relaxed);
+		if (position == tail.load(std::memory_order_acquire)) {
+			return false;
+		}
+		T &item = items[position & (capacity - 1)];
+		r_value = std::move(item);
+		item = T();
+		head.store(position + 1, std::memory_order_release);
+		return true;
+	}
+
+	SPSCQueue() {}
+	SPSCQueue(const SPSCQueue &) = delete;
+	SPSCQueue &operator=(const SPSCQueue &) = delete;
+	~SPSCQueue() {
+		if (items) {
+			memdelete_arr(items);
+		}
+	}
+};
+
+#endif //LAGGYMULTIPLAYERPEER_SPSC_QUEUE_H